@@ -0,0 +1,101 @@
+// MAP_ANONYMOUS and MAP_NORESERVE are not part of POSIX
+#define _DEFAULT_SOURCE
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// Start of the shared segment, followed by the allocated memory
+struct ArenaHeader {
+  pthread_mutex_t mutex;  // Mutex to protect used, shared by the processes
+  size_t size;            // Size of the segment
+  size_t used;            // Bytes allocated from the start of the segment
+};
+
+#define ARENA_ALIGNMENT 16
+
+static struct ArenaHeader* arena = NULL;
+
+/// Rounds a size up to the alignment of the allocations.
+static size_t align_up(size_t size) { return (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT; }
+
+int arena_init(size_t size) {
+  if (arena != NULL || size <= sizeof(struct ArenaHeader)) return 1;
+
+  void* segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (segment == MAP_FAILED) return 1;
+
+  struct ArenaHeader* header = (struct ArenaHeader*)segment;
+  header->size = size;
+  header->used = align_up(sizeof(struct ArenaHeader));
+
+  pthread_mutexattr_t attr;
+  if (pthread_mutexattr_init(&attr) != 0) {
+    munmap(segment, size);
+    return 1;
+  }
+
+  int result = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 ||
+               pthread_mutex_init(&header->mutex, &attr) != 0;
+  pthread_mutexattr_destroy(&attr);
+
+  if (result != 0) {
+    munmap(segment, size);
+    return 1;
+  }
+
+  arena = header;
+  return 0;
+}
+
+void arena_destroy() {
+  if (arena == NULL) return;
+
+  pthread_mutex_destroy(&arena->mutex);
+  munmap(arena, arena->size);
+  arena = NULL;
+}
+
+void* arena_alloc(size_t size) {
+  if (arena == NULL) return malloc(size);
+
+  void* ptr = NULL;
+
+  pthread_mutex_lock(&arena->mutex);
+  if (size <= arena->size - arena->used) {
+    ptr = (char*)arena + arena->used;
+    arena->used += align_up(size);
+  }
+  pthread_mutex_unlock(&arena->mutex);
+
+  return ptr;
+}
+
+void arena_free(void* ptr) {
+  if (arena == NULL) free(ptr);
+}
+
+int arena_mutex_init(pthread_mutex_t* mutex) {
+  if (arena == NULL) return pthread_mutex_init(mutex, NULL) != 0;
+
+  pthread_mutexattr_t attr;
+  if (pthread_mutexattr_init(&attr) != 0) return 1;
+
+  int result =
+      pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 || pthread_mutex_init(mutex, &attr) != 0;
+  pthread_mutexattr_destroy(&attr);
+  return result;
+}
+
+int arena_rwlock_init(pthread_rwlock_t* rwl) {
+  if (arena == NULL) return pthread_rwlock_init(rwl, NULL) != 0;
+
+  pthread_rwlockattr_t attr;
+  if (pthread_rwlockattr_init(&attr) != 0) return 1;
+
+  int result =
+      pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 || pthread_rwlock_init(rwl, &attr) != 0;
+  pthread_rwlockattr_destroy(&attr);
+  return result;
+}
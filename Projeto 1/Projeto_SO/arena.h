@@ -0,0 +1,36 @@
+#ifndef EMS_ARENA_H
+#define EMS_ARENA_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/// Maps a memory segment shared by the process and the children it forks afterwards, where the EMS state is then
+/// allocated.
+/// @note Memory allocated in the segment is only given back when it is unmapped.
+/// @param size Size of the segment in bytes, only the pages that are used take memory.
+/// @return 0 if the segment was mapped successfully, 1 otherwise.
+int arena_init(size_t size);
+
+/// Unmaps the shared segment, if there is one.
+void arena_destroy();
+
+/// Allocates memory for the EMS state, in the shared segment if there is one.
+/// @param size Number of bytes to allocate.
+/// @return Pointer to the allocated memory, NULL on failure.
+void* arena_alloc(size_t size);
+
+/// Frees memory allocated by arena_alloc.
+/// @param ptr Pointer to the memory to free.
+void arena_free(void* ptr);
+
+/// Initializes a mutex, shared by processes if the EMS state is shared.
+/// @param mutex Mutex to initialize, allocated by arena_alloc.
+/// @return 0 if the mutex was initialized successfully, 1 otherwise.
+int arena_mutex_init(pthread_mutex_t* mutex);
+
+/// Initializes a rwlock, shared by processes if the EMS state is shared.
+/// @param rwl Rwlock to initialize, allocated by arena_alloc.
+/// @return 0 if the rwlock was initialized successfully, 1 otherwise.
+int arena_rwlock_init(pthread_rwlock_t* rwl);
+
+#endif  // EMS_ARENA_H
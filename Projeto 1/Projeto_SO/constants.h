@@ -1,3 +1,9 @@
 #define MAX_RESERVATION_SIZE 256
 #define STATE_ACCESS_DELAY_MS 10
 #define MAX_INT_DIGITS 10
+#define READ_BUFFER_SIZE 65536
+#define MAX_BUFFERED_FDS 1024
+#define MAX_PENDING_COMMANDS 1024
+#define SHARED_STATE_SIZE ((size_t)1 << 30)  // 1 GiB, only the pages used take memory
+#define OUT_BUFFER_SIZE 65536
+#define OUT_SEAT_BATCH 256
@@ -2,18 +2,24 @@
 
 #include <stdlib.h>
 
+#include "arena.h"
+
 struct EventList* create_list() {
-  struct EventList* list = (struct EventList*)malloc(sizeof(struct EventList));
+  struct EventList* list = (struct EventList*)arena_alloc(sizeof(struct EventList));
   if (!list) return NULL;
   list->head = NULL;
   list->tail = NULL;
+  if (arena_rwlock_init(&list->rwl) != 0) {
+    arena_free(list);
+    return NULL;
+  }
   return list;
 }
 
 int append_to_list(struct EventList* list, struct Event* event) {
   if (!list) return 1;
 
-  struct ListNode* new_node = (struct ListNode*)malloc(sizeof(struct ListNode));
+  struct ListNode* new_node = (struct ListNode*)arena_alloc(sizeof(struct ListNode));
   if (!new_node) return 1;
 
   new_node->event = event;
@@ -33,8 +39,9 @@ int append_to_list(struct EventList* list, struct Event* event) {
 static void free_event(struct Event* event) {
   if (!event) return;
 
-  free(event->data);
-  free(event);
+  pthread_mutex_destroy(&event->mutex);
+  arena_free(event->data);
+  arena_free(event);
 }
 
 void free_list(struct EventList* list) {
@@ -46,10 +53,11 @@ void free_list(struct EventList* list) {
     current = current->next;
 
     free_event(temp->event);
-    free(temp);
+    arena_free(temp);
   }
 
-  free(list);
+  pthread_rwlock_destroy(&list->rwl);
+  arena_free(list);
 }
 
 struct Event* get_event(struct EventList* list, unsigned int event_id) {
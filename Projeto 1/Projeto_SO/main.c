@@ -6,139 +6,317 @@
 #include <fcntl.h>
 #include <string.h>
 #include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
 
+#include "arena.h"
 #include "constants.h"
+#include "jobfile.h"
 #include "operations.h"
 #include "parser.h"
+#include "scheduler.h"
+
+/// Runs a command of a job file, or submits it to the threads.
+/// @param scheduler Scheduler running the commands of the job file.
+/// @param command Command to run.
+/// @return 0 if the command was run or submitted, 1 otherwise.
+static int run_command(struct Scheduler *scheduler, const struct JobCommand *command) {
+	switch (command->cmd) {
+		case CMD_CREATE:
+		case CMD_RESERVE:
+		case CMD_SHOW:
+		case CMD_LIST_EVENTS:
+			return scheduler_submit(scheduler, command);
+
+		case CMD_WAIT:
+			if (command->delay > 0)
+				scheduler_delay(scheduler, command->delay, command->thread_id);
+			break;
+
+		case CMD_INVALID:
+			fprintf(stderr, "Invalid command. See HELP for usage\n");
+			break;
+
+		case CMD_HELP:
+			printf(
+				"Available commands:\n"
+				"  CREATE <event_id> <num_rows> <num_columns>\n"
+				"  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
+				"  SHOW <event_id>\n"
+				"  LIST\n"
+				"  WAIT <delay_ms> [thread_id]\n"
+				"  BARRIER\n"
+				"  HELP\n");
+			break;
+
+		case CMD_BARRIER:
+			// Every command before the barrier must be done before the next one starts
+			scheduler_barrier(scheduler);
+			break;
+
+		case CMD_EMPTY:
+		case EOC:
+			break;
+	}
 
-typedef struct {
-	pthread_t thread_id;
-	int thread_num;
-	int num_threads;
-	int input_fd, output_fd;
-	int num_lines;
-} ThreadData;
-
-
-void *thread_function(void *args) {
-
-	ThreadData *data = (ThreadData *) args;
-	int input_fd = data->input_fd;
-	int output_fd = data->output_fd;
-	int thread_num = (int) data->thread_num;
-	int num_threads = (int) data->num_threads;
-	int num_lines = data->num_lines;
-	int *status = malloc(sizeof(int));
-	
+	return 0;
+}
 
-	while (1) {
-		unsigned int event_id, delay, thread_id;
-		size_t num_rows, num_columns, num_coords;
-		size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
-		enum Command cmd;
-
-		switch (cmd = get_next(input_fd)) {
-			case CMD_CREATE:
-				if (num_lines % num_threads == thread_num % num_threads) {
-					printf("Thread %d ran %u\n", thread_num, cmd);
-					if (parse_create(input_fd, &event_id, &num_rows, &num_columns) != 0) {
-						fprintf(stderr, "Invalid command. See HELP for usage\n");
-						continue;
-					}
-
-					if (ems_create(event_id, num_rows, num_columns))
-						fprintf(stderr, "Failed to create event\n");
-				}
-				
-				break;
+/// Parses the next command of a job file.
+/// @param input_fd File descriptor of the job file.
+/// @param command Command to store the parsed command in, CMD_INVALID if it is not valid.
+/// @param xs Buffer for the rows of the seats of a RESERVE.
+/// @param ys Buffer for the columns of the seats of a RESERVE.
+static void parse_command(int input_fd, struct JobCommand *command, size_t *xs, size_t *ys) {
+	int invalid = 0;
+
+	switch (command->cmd = get_next(input_fd)) {
+		case CMD_CREATE:
+			invalid = parse_create(input_fd, &command->event_id, &command->num_rows, &command->num_columns) != 0;
+			break;
+
+		case CMD_RESERVE:
+			command->num_coords = parse_reserve(input_fd, MAX_RESERVATION_SIZE, &command->event_id, xs, ys);
+			command->xs = xs;
+			command->ys = ys;
+			invalid = command->num_coords == 0;
+			break;
+
+		case CMD_SHOW:
+			invalid = parse_show(input_fd, &command->event_id) != 0;
+			break;
+
+		case CMD_WAIT:
+			command->thread_id = 0;
+			invalid = parse_wait(input_fd, &command->delay, &command->thread_id) == -1;
+			break;
+
+		case CMD_LIST_EVENTS:
+		case CMD_BARRIER:
+		case CMD_HELP:
+		case CMD_EMPTY:
+		case CMD_INVALID:
+		case EOC:
+			break;
+	}
+
+	if (invalid)
+		command->cmd = CMD_INVALID;
+}
 
-			case CMD_RESERVE:
-				if (num_lines % num_threads == thread_num % num_threads) {
-					printf("Thread %d ran %u\n", thread_num, cmd);
-					num_coords = parse_reserve(input_fd, MAX_RESERVATION_SIZE, &event_id, xs, ys);
+/// Loads a record of a compiled job file as a command, pointing to the seats in the mapped file.
+/// @param record Record to load.
+/// @param xs Rows of the seats of a RESERVE.
+/// @param ys Columns of the seats of a RESERVE.
+/// @param command Command to store the record in.
+static void load_record(const struct JobRecord *record, const size_t *xs, const size_t *ys,
+                        struct JobCommand *command) {
+	command->event_id = record->event_id;
+	command->num_rows = (size_t) record->arg1;
+	command->num_columns = (size_t) record->arg2;
+	command->delay = (unsigned int) record->arg1;
+	command->thread_id = (unsigned int) record->arg2;
+	command->num_coords = (size_t) record->num_coords;
+	command->xs = xs;
+	command->ys = ys;
+
+	switch ((enum JobOp) record->op) {
+		case JOB_CREATE:
+			command->cmd = CMD_CREATE;
+			break;
+		case JOB_RESERVE:
+			command->cmd = CMD_RESERVE;
+			break;
+		case JOB_SHOW:
+			command->cmd = CMD_SHOW;
+			break;
+		case JOB_LIST_EVENTS:
+			command->cmd = CMD_LIST_EVENTS;
+			break;
+		case JOB_WAIT:
+			command->cmd = CMD_WAIT;
+			break;
+		case JOB_BARRIER:
+			command->cmd = CMD_BARRIER;
+			break;
+		case JOB_HELP:
+			command->cmd = CMD_HELP;
+			break;
+		case JOB_DELETE:  // Only the client deletes events
+		case JOB_INVALID:
+			command->cmd = CMD_INVALID;
+			break;
+	}
+}
 
-					if (num_coords == 0) {
-						fprintf(stderr, "Invalid command. See HELP for usage\n");
-						continue;
-					}
+/// Runs the commands of a job file on a pool of threads, parsing each of them once.
+/// @param input_fd File descriptor of the job file.
+/// @param output_fd File descriptor to write the output of the commands to.
+/// @param num_threads Number of threads running the commands.
+/// @param compiled Whether the job file was compiled by jobc, in which case it is mapped and run without parsing.
+/// @return 0 if the file was run, 1 otherwise.
+static int run_job_file(int input_fd, int output_fd, int num_threads, int compiled) {
+	struct CompiledJob job;
+	if (compiled && jobfile_map(input_fd, &job) != 0) {
+		fprintf(stderr, "Invalid compiled job file\n");
+		close(input_fd);
+		return 1;
+	}
 
-					if (ems_reserve(event_id, num_coords, xs, ys))
-						fprintf(stderr, "Failed to reserve seats\n");
-				}
+	struct Scheduler *scheduler = scheduler_create(num_threads, output_fd);
+	size_t *seats = compiled ? NULL : malloc(2 * MAX_RESERVATION_SIZE * sizeof(size_t));
+	if (scheduler == NULL || (!compiled && seats == NULL)) {
+		fprintf(stderr, "Failed to start threads\n");
+		if (scheduler != NULL)
+			scheduler_destroy(scheduler);
+		if (compiled)
+			jobfile_unmap(&job);
+		free(seats);
+		close(input_fd);
+		return 1;
+	}
 
+	int result = 0;
+	struct JobCommand command = {0};
+	while (result == 0) {
+		if (compiled) {
+			const struct JobRecord *record;
+			const size_t *xs = NULL, *ys = NULL;
+			int next = jobfile_next(&job, &record, &xs, &ys);
+			if (next == 0)
 				break;
+			if (next == -1) {
+				fprintf(stderr, "Invalid compiled job file\n");
+				result = 1;
+				break;
+			}
 
-			case CMD_SHOW:
-				if (num_lines % num_threads == thread_num % num_threads) {
-					printf("Thread %d ran %u\n", thread_num, cmd);
-					if (parse_show(input_fd, &event_id) != 0) {
-						fprintf(stderr, "Invalid command. See HELP for usage\n");
-						continue;
-					}
+			load_record(record, xs, ys, &command);
+		} else {
+			parse_command(input_fd, &command, seats, seats + MAX_RESERVATION_SIZE);
+			if (command.cmd == EOC)
+				break;
+		}
 
-					if (ems_show(output_fd, event_id)) 
-						fprintf(stderr, "Failed to show event\n");
-				}
+		result = run_command(scheduler, &command);
+	}
 
-				break;
+	if (scheduler_destroy(scheduler) != 0)
+		result = 1;
 
-			case CMD_LIST_EVENTS:
-				if (num_lines % num_threads == thread_num % num_threads) {
-					printf("Thread %d ran %u\n", thread_num, cmd);
-					if (ems_list_events(output_fd))
-						fprintf(stderr, "Failed to list events\n");
-				}
+	if (compiled) {
+		jobfile_unmap(&job);
+	} else {
+		free_read_buffer(input_fd);
+		free(seats);
+	}
+	close(input_fd);
+	return result;
+}
 
-				break;
+// Job file found in the directory
+typedef struct {
+	char name[NAME_MAX + 1];
+	off_t size;
+} JobFile;
 
-			case CMD_WAIT:
-				if (parse_wait(input_fd, &delay, &thread_id) == -1) {  // thread_id is not implemented
-					fprintf(stderr, "Invalid command. See HELP for usage\n");
-					continue;
-				}
+// Child process running a job file
+typedef struct {
+	pid_t pid;
+	off_t size;
+	struct timespec start;
+} RunningJob;
+
+static int compare_job_size(const void *a, const void *b) {
+	off_t x = ((const JobFile *) a)->size, y = ((const JobFile *) b)->size;
+	return (x < y) - (x > y);  // Largest first
+}
 
-				if (((int) thread_id == thread_num || (int) thread_id == 0) && delay > 0) {
-					printf("Waiting...\n");
-					ems_wait(delay);
-				}
+static double elapsed_seconds(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
 
-				break;
+/// Estimates the work left in a job file.
+/// @param size Size of the file in bytes.
+/// @param elapsed Seconds it has been running for.
+/// @param throughput Bytes per second of the job files already done, 0 if none is done.
+/// @return Seconds of work left, or the size of the file until a throughput is known.
+static double remaining_work(off_t size, double elapsed, double throughput) {
+	if (throughput <= 0)
+		return (double) size;
+
+	double left = (double) size / throughput - elapsed;
+	return left > 0 ? left : 0;
+}
 
-			case CMD_INVALID:
-				fprintf(stderr, "Invalid command. See HELP for usage\n");
-				break;
+/// Chooses the number of threads for a job file, giving each file a share of the CPUs proportional to its share of
+/// the work left in the running files.
+/// @param cpus Number of CPUs.
+/// @param max_proc Maximum number of processes.
+/// @param size Size of the job file in bytes.
+/// @param running Job files running.
+/// @param num_running Number of job files running.
+/// @param throughput Bytes per second of the job files already done, 0 if none is done.
+/// @return Number of threads, between 1 and cpus.
+static int choose_threads(int cpus, int max_proc, off_t size, const RunningJob *running, int num_running,
+                          double throughput) {
+	double work = remaining_work(size, 0, throughput);
+	double total = work;
+	for (int i = 0; i < num_running; i++)
+		total += remaining_work(running[i].size, elapsed_seconds(&running[i].start), throughput);
+
+	int threads = total > 0 ? (int) ((double) cpus * work / total + 0.5) : cpus / max_proc;
+	if (threads < 1)
+		threads = 1;
+	return threads < cpus ? threads : cpus;
+}
 
-			case CMD_HELP:
-				printf(
-					"Available commands:\n"
-					"  CREATE <event_id> <num_rows> <num_columns>\n"
-					"  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
-					"  SHOW <event_id>\n"
-					"  LIST\n"
-					"  WAIT <delay_ms> [thread_id]\n"  // thread_id is not implemented
-					"  BARRIER\n"                      // Not implemented
-					"  HELP\n");
+/// Runs a job file in the calling (child) process.
+/// @param dir_path Path of the directory with the job file.
+/// @param name Name of the job file.
+/// @param num_threads Number of threads running the commands.
+/// @return 0 if the file was run, 1 otherwise.
+static int run_child(const char *dir_path, const char *name, int num_threads) {
+	// Prepare file path
+	char input_file_path[PATH_MAX], output_file_path[PATH_MAX];
+	snprintf(input_file_path, PATH_MAX, "%s/%s", dir_path, name);
+	printf("%s\n", input_file_path);
+
+	strcpy(output_file_path, input_file_path);
+	char *extension = strrchr(output_file_path, '.');  // Find the last occurrence of '.'
+	if (extension != NULL) {
+		// Replace everything after the dot with the new extension
+		strcpy(extension + 1, "out");
+	}
 
-				break;
+	// Open file
+	int openFlags = O_CREAT | O_WRONLY | O_TRUNC;
+	mode_t filePerms = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
 
-			case CMD_BARRIER:  // Not implemented
-				num_lines++;
-				*status = 1;
-				return (void *) status;
+	int output_fd = open(output_file_path, openFlags, filePerms);
+	if (output_fd == -1)
+		fprintf(stderr, "opening file %s", output_file_path);
 
-			case CMD_EMPTY:
-				break;
+	int input_fd = open(input_file_path, O_RDONLY);
+	if (input_fd == -1) {
+		fprintf(stderr, "Failed to open file\n");
+		return 1;
+	}
 
-			case EOC:
-				close(input_fd);
-				*status = 0;
-				return (void *) status;
-		}
+	const char *dot = strrchr(name, '.');
+	int compiled = dot != NULL && strcmp(dot, ".jobc") == 0;
+	if (run_job_file(input_fd, output_fd, num_threads, compiled) != 0)
+		return 1;
 
-		num_lines++;
-		printf("Thread %d on line %d with command %u\n", thread_num, num_lines, cmd);
-		cleanup(input_fd);
+	if (close(output_fd) == -1) {
+		fprintf(stderr, "Failed to close file\n");
+		return 1;
 	}
+
+	return 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -157,6 +335,13 @@ int main(int argc, char *argv[]) {
         state_access_delay_ms = (unsigned int)delay;
     }
 
+    // Share the EMS state between the processes running the job files if requested
+    const char *shared_state = getenv("EMS_SHARED_STATE");
+    if (shared_state != NULL && strcmp(shared_state, "0") != 0 && arena_init(SHARED_STATE_SIZE)) {
+        fprintf(stderr, "Failed to map shared EMS state\n");
+        return 1;
+    }
+
     // Initialize EMS
     if (ems_init(state_access_delay_ms)) {
         fprintf(stderr, "Failed to initialize EMS\n");
@@ -168,18 +353,24 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-	int MAX_THREADS = atoi(argv[3]);
+	// "auto" sizes the processes and threads from the CPUs and the job files
+	int auto_threads = argc > 3 && strcmp(argv[3], "auto") == 0;
+	int MAX_THREADS = auto_threads ? 1 : argc > 3 ? atoi(argv[3]) : 0;
 	if (MAX_THREADS <= 0) {
 		fprintf(stderr, "Invalid number of files\n");
 		return 1;
 	}
 
-    int MAX_PROC = atoi(argv[2]);
+    int auto_proc = strcmp(argv[2], "auto") == 0;
+    int MAX_PROC = auto_proc ? 1 : atoi(argv[2]);
     if (MAX_PROC <= 0) {
         fprintf(stderr, "Invalid number of files\n");
         return 1;
     }
 
+    long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int cpus = online_cpus > 0 ? (int) online_cpus : 1;
+
     // Open directory
     struct dirent *dp;
     
@@ -189,142 +380,113 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    int status, running_children = 0;
-    pid_t pid = 1;
-    while(1) {
-        dp = readdir(dir);
-        if (dp == NULL)
-            break;
+    // List the job files first, so that they can be run in any order
+    JobFile *files = NULL;
+    size_t num_files = 0, files_capacity = 0;
+    while ((dp = readdir(dir)) != NULL) {
         if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0 || strstr(dp->d_name, ".out") != NULL)
             continue; /* Skip . and .. and *.out */
-        
-        if (running_children < MAX_PROC) {
-            running_children++;
-        } else {
-            wait(&status);
-            printf("%d\n", status);
-        }
 
-        pid = fork();
-        if (pid == -1) {
-            fprintf(stderr, "Failed to fork\n");
-            return 1;
+        if (num_files == files_capacity) {
+            files_capacity = files_capacity ? files_capacity * 2 : 16;
+            JobFile *resized = realloc(files, files_capacity * sizeof(JobFile));
+            if (resized == NULL) {
+                fprintf(stderr, "Failed to allocate memory for job files\n");
+                free(files);
+                closedir(dir);
+                return 1;
+            }
+            files = resized;
         }
-		
-        if (pid == 0) {
-            // Prepare file path
-            char input_file_path[PATH_MAX], output_file_path[PATH_MAX];
-            snprintf(input_file_path, PATH_MAX, "%s/%s", argv[1], dp->d_name);
-			printf("%s\n", input_file_path);
-
-			strcpy(output_file_path, input_file_path);
-			char *extension = strrchr(output_file_path, '.');  // Find the last occurrence of '.'
-			if (extension != NULL) {
-				// Replace everything after the dot with the new extension
-				strcpy(extension + 1, "out");
-			}
 
-			// Open file
-            int openFlags = O_CREAT | O_WRONLY | O_TRUNC;
-            mode_t filePerms = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, PATH_MAX, "%s/%s", argv[1], dp->d_name);
+        strcpy(files[num_files].name, dp->d_name);
+        files[num_files].size = stat(path, &st) == 0 ? st.st_size : 0;
+        num_files++;
+    }
 
-            int output_fd = open(output_file_path, openFlags, filePerms); 
-            if (output_fd == -1)
-                fprintf(stderr, "opening file %s", argv[2]);
+    // Close directory
+    if (closedir(dir) == -1) {
+        fprintf(stderr, "Failed to close directory\n");
+        free(files);
+        return 1;
+    }
 
-            ThreadData **threads_data = malloc((unsigned) MAX_THREADS * sizeof(ThreadData *));
-			if (threads_data == NULL) {
-				fprintf(stderr, "Failed to allocate memory for threads_data\n");
-				return 1;
-			}
+    if (auto_proc || auto_threads) {
+        // Largest files first, so that a large file started last does not make every other process wait for it
+        qsort(files, num_files, sizeof(JobFile), compare_job_size);
+    }
 
-			for (int i = 0; i < MAX_THREADS; i++) {
-				threads_data[i] = malloc(sizeof(ThreadData));
-				if (threads_data[i] == NULL) {
-					fprintf(stderr, "Failed to allocate memory for threads_data[%d]\n", i);
-					return 1;
-				}
-
-				threads_data[i]->thread_num = i + 1;
-				threads_data[i]->num_threads = MAX_THREADS;
-				threads_data[i]->input_fd = open(input_file_path, O_RDONLY);
-				if (threads_data[i]->input_fd == -1) {
-					fprintf(stderr, "Failed to open file\n");
-					return 1;
-				}
-				threads_data[i]->output_fd = output_fd;
-				threads_data[i]->num_lines = 0;
-
-				if (pthread_create(&threads_data[i]->thread_id, NULL, thread_function, (void *) threads_data[i]) != 0) {
-					fprintf(stderr, "Failed to create thread\n");
-					return 1;
-				}
-			}
+    if (auto_proc)
+        MAX_PROC = num_files == 0 ? 1 : num_files < (size_t) cpus ? (int) num_files : cpus;
 
-			int *threads_return_value[MAX_THREADS];
-			int barrier_found = 0;
-			while (1) {
-				for (int i = 0; i < MAX_THREADS; i++) {
-					if (pthread_join(threads_data[i]->thread_id, (void **) &threads_return_value[i]) != 0) {
-						fprintf(stderr, "Failed to join thread\n");
-						return 1;
-					}
-
-					printf("Thread %d returned %d\n", i, *threads_return_value[i]);
-					if (*threads_return_value[i] == 1) {
-						barrier_found = 1;
-						continue;
-					} else
-						barrier_found = 0;
-					
-					free(threads_return_value[i]);
-				}
-
-				if (!barrier_found) {
-					for (int i = 0; i < MAX_THREADS; i++)
-						free(threads_data[i]);
-					break;
-
-				} else {
-					for (int i = 0; i < MAX_THREADS; i++) {
-						if (pthread_create(&threads_data[i]->thread_id, NULL, thread_function, (void *) threads_data[i]) != 0) {
-							fprintf(stderr, "Failed to create thread\n");
-							return 1;
-						}
-					}
-
-					barrier_found = 0;
-				}
-			}
+    RunningJob *running = malloc((size_t) MAX_PROC * sizeof(RunningJob));
+    if (running == NULL) {
+        fprintf(stderr, "Failed to allocate memory for job files\n");
+        free(files);
+        return 1;
+    }
 
-			if (close(output_fd) == -1) {
-                fprintf(stderr, "Failed to close file\n");
-                return 1;
+    int status, running_children = 0;
+    double bytes_done = 0, seconds_done = 0;
+    for (size_t f = 0; f <= num_files; f++) {
+        // Wait for a child when every process is busy, or for all of them once every file was started
+        while (running_children > 0 && (running_children == MAX_PROC || f == num_files)) {
+            pid_t done = wait(&status);
+            if (done == -1)
+                break;
+            printf("%d\n", status);
+
+            for (int i = 0; i < running_children; i++) {
+                if (running[i].pid == done) {
+                    bytes_done += (double) running[i].size;
+                    seconds_done += elapsed_seconds(&running[i].start);
+                    running[i] = running[--running_children];
+                    break;
+                }
             }
-			
-            exit(0);
         }
-	}
 
-    if (pid > 0) {
-        while (running_children > 0) {
-            wait(&status);
-            printf("%d\n", status);
-            running_children--;
+        if (f == num_files)
+            break;
+
+        int num_threads = MAX_THREADS;
+        if (auto_threads) {
+            double throughput = seconds_done > 0 ? bytes_done / seconds_done : 0;
+            num_threads = choose_threads(cpus, MAX_PROC, files[f].size, running, running_children, throughput);
         }
-    }
 
-    // Close directory
-    if (closedir(dir) == -1) {
-        fprintf(stderr, "Failed to close directory\n");
-        return 1;
-    }
+        pid_t pid = fork();
+        if (pid == -1) {
+            fprintf(stderr, "Failed to fork\n");
+            return 1;
+        }
+		
+        if (pid == 0) {
+            int result = run_child(argv[1], files[f].name, num_threads);
+            free(files);
+            free(running);
+            exit(result);
+        }
+
+        running[running_children].pid = pid;
+        running[running_children].size = files[f].size;
+        clock_gettime(CLOCK_MONOTONIC, &running[running_children].start);
+        running_children++;
+	}
+
+    free(files);
+    free(running);
 
 	// Free EMS
 	if (ems_terminate()) {
 		fprintf(stderr, "Failed to destroy EMS\n");
 		return 1;
 	}
+
+	arena_destroy();
 	
 	return 0;
 }
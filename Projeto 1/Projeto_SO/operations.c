@@ -3,8 +3,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "arena.h"
 #include "eventlist.h"
 #include "constants.h"
+#include "outbuf.h"
 
 static struct EventList* event_list = NULL;
 static unsigned int state_access_delay_ms = 0;
@@ -24,7 +26,11 @@ static struct Event* get_event_with_delay(unsigned int event_id) {
   struct timespec delay = delay_to_timespec(state_access_delay_ms);
   nanosleep(&delay, NULL);  // Should not be removed
 
-  return get_event(event_list, event_id);
+  pthread_rwlock_rdlock(&event_list->rwl);
+  struct Event* event = get_event(event_list, event_id);
+  pthread_rwlock_unlock(&event_list->rwl);
+
+  return event;
 }
 
 /// Gets the seat with the given index from the state.
@@ -47,6 +53,19 @@ static unsigned int* get_seat_with_delay(struct Event* event, size_t index) {
 /// @return Index of the seat.
 static size_t seat_index(struct Event* event, size_t row, size_t col) { return (row - 1) * event->cols + col - 1; }
 
+/// Gets a row of seats from the state, so that it is formatted at once.
+/// @note Will wait as long as getting each of its seats with get_seat_with_delay, in a single sleep.
+/// @param event Event to get the row from.
+/// @param row Row to get.
+/// @return Pointer to the first seat of the row.
+static unsigned int* get_row_with_delay(struct Event* event, size_t row) {
+  unsigned long long delay_ms = (unsigned long long)state_access_delay_ms * event->cols;
+  struct timespec delay = {(time_t)(delay_ms / 1000), (long)(delay_ms % 1000) * 1000000};
+  nanosleep(&delay, NULL);  // Should not be removed
+
+  return &event->data[seat_index(event, row, 1)];
+}
+
 int ems_init(unsigned int delay_ms) {
   if (event_list != NULL) {
     fprintf(stderr, "EMS state has already been initialized\n");
@@ -80,7 +99,7 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
     return 1;
   }
 
-  struct Event* event = malloc(sizeof(struct Event));
+  struct Event* event = arena_alloc(sizeof(struct Event));
 
   if (event == NULL) {
     fprintf(stderr, "Error allocating memory for event\n");
@@ -91,11 +110,18 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
   event->rows = num_rows;
   event->cols = num_cols;
   event->reservations = 0;
-  event->data = malloc(num_rows * num_cols * sizeof(unsigned int));
+  event->data = arena_alloc(num_rows * num_cols * sizeof(unsigned int));
 
   if (event->data == NULL) {
     fprintf(stderr, "Error allocating memory for event data\n");
-    free(event);
+    arena_free(event);
+    return 1;
+  }
+
+  if (arena_mutex_init(&event->mutex) != 0) {
+    fprintf(stderr, "Error initializing event mutex\n");
+    arena_free(event->data);
+    arena_free(event);
     return 1;
   }
 
@@ -103,10 +129,16 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
     event->data[i] = 0;
   }
 
-  if (append_to_list(event_list, event) != 0) {
-    fprintf(stderr, "Error appending event to list\n");
-    free(event->data);
-    free(event);
+  // Another process sharing the state may have created the event in the meantime
+  pthread_rwlock_wrlock(&event_list->rwl);
+  int appended = get_event(event_list, event_id) == NULL ? append_to_list(event_list, event) : -1;
+  pthread_rwlock_unlock(&event_list->rwl);
+
+  if (appended != 0) {
+    fprintf(stderr, appended == -1 ? "Event already exists\n" : "Error appending event to list\n");
+    pthread_mutex_destroy(&event->mutex);
+    arena_free(event->data);
+    arena_free(event);
     return 1;
   }
 
@@ -126,6 +158,7 @@ int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys)
     return 1;
   }
 
+  pthread_mutex_lock(&event->mutex);
   unsigned int reservation_id = ++event->reservations;
 
   size_t i = 0;
@@ -152,9 +185,11 @@ int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys)
     for (size_t j = 0; j < i; j++) {
       *get_seat_with_delay(event, seat_index(event, xs[j], ys[j])) = 0;
     }
+    pthread_mutex_unlock(&event->mutex);
     return 1;
   }
 
+  pthread_mutex_unlock(&event->mutex);
   return 0;
 }
 
@@ -171,32 +206,22 @@ int ems_show(int fd, unsigned int event_id) {
     return 1;
   }
 
-  for (size_t i = 1; i <= event->rows; i++) {
-    for (size_t j = 1; j <= event->cols; j++) {
-      unsigned int* seat = get_seat_with_delay(event, seat_index(event, i, j));
-      char seat_str[MAX_INT_DIGITS + 1];
+  struct OutBuffer out;
+  out_init(&out, fd);
+  int result = 0;
 
-      snprintf(seat_str, MAX_INT_DIGITS + 1, "%u", *seat);
-      if (write(fd, seat_str, MAX_INT_DIGITS + 1) == -1) {
-        fprintf(stderr, "Error writing to file\n");
-        return 1;
-      }
-
-      if (j < event->cols) {
-        if (write(fd, " ", 2) == -1) {
-          fprintf(stderr, "Error writing to file\n");
-          return 1;
-        }
-      }
-    }
+  pthread_mutex_lock(&event->mutex);
 
-    if (write(fd, "\n", 2) == -1) {
-      fprintf(stderr, "Error writing to file\n");
-      return 1;
-    }
+  for (size_t i = 1; i <= event->rows && result == 0; i++) {
+    unsigned int* row = get_row_with_delay(event, i);
+    result = event->cols > 0 ? out_seats(&out, row, event->cols, '\n') : out_str(&out, "\n");
   }
 
-  return 0;
+  pthread_mutex_unlock(&event->mutex);
+
+  if (result == 0) result = out_flush(&out);
+  if (result) fprintf(stderr, "Error writing to file\n");
+  return result;
 }
 
 int ems_list_events(int fd) {
@@ -205,33 +230,28 @@ int ems_list_events(int fd) {
     return 1;
   }
 
+  struct OutBuffer out;
+  out_init(&out, fd);
+  int result;
+
+  pthread_rwlock_rdlock(&event_list->rwl);
+
   if (event_list->head == NULL) {
     printf("No events\n");
-    if (write(fd, "No events\n", 10) == -1) {
-      fprintf(stderr, "Error writing to file\n");
-      return 1;
+    result = out_str(&out, "No events\n");
+  } else {
+    result = 0;
+    for (struct ListNode* current = event_list->head; current != NULL && result == 0; current = current->next) {
+      printf("Event: ");
+      result = out_str(&out, "Event: ") || out_uint(&out, (current->event)->id) || out_str(&out, "\n");
     }
-    return 0;
   }
 
-  struct ListNode* current = event_list->head;
-  while (current != NULL) {
-    char id_str[MAX_INT_DIGITS + 1];
-    printf("Event: ");
-    if (write(fd, "Event: ", 8) == -1) {
-      fprintf(stderr, "Error writing to file\n");
-      return 1;
-    }
+  pthread_rwlock_unlock(&event_list->rwl);
 
-    snprintf(id_str, MAX_INT_DIGITS + 1, "%u\n", (current->event)->id);
-    if (write(fd, id_str, 2) == -1) {
-      fprintf(stderr, "Error writing to file\n");
-      return 1;
-    }
-    current = current->next;
-  }
-
-  return 0;
+  if (result == 0) result = out_flush(&out);
+  if (result) fprintf(stderr, "Error writing to file\n");
+  return result;
 }
 
 void ems_wait(unsigned int delay_ms) {
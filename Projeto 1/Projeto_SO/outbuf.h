@@ -0,0 +1,60 @@
+#ifndef EMS_OUTBUF_H
+#define EMS_OUTBUF_H
+
+#include <stddef.h>
+
+#include "constants.h"
+
+// Output kept in memory until it fills up or is flushed, so that it is written with few system calls
+struct OutBuffer {
+  int fd;                      // File descriptor to write to
+  size_t used;                 // Number of bytes in data
+  char data[OUT_BUFFER_SIZE];  // Bytes not written yet
+};
+
+/// Initializes an empty output buffer.
+/// @param out The output buffer.
+/// @param fd The file descriptor it writes to.
+void out_init(struct OutBuffer* out, int fd);
+
+/// Appends bytes to an output buffer, writing it together with them if they do not fit.
+/// @param out The output buffer.
+/// @param data The bytes to append.
+/// @param len Number of bytes to append.
+/// @return 0 if the bytes were appended successfully, 1 if writing failed.
+int out_write(struct OutBuffer* out, const void* data, size_t len);
+
+/// Appends a string to an output buffer.
+/// @param out The output buffer.
+/// @param str The string to append.
+/// @return 0 if the string was appended successfully, 1 if writing failed.
+int out_str(struct OutBuffer* out, const char* str);
+
+/// Appends an unsigned integer in decimal to an output buffer.
+/// @param out The output buffer.
+/// @param value The value to append.
+/// @return 0 if the integer was appended successfully, 1 if writing failed.
+int out_uint(struct OutBuffer* out, unsigned int value);
+
+/// Appends seats in decimal to an output buffer, separated by spaces.
+/// @note Rows of free seats and blocks of single digits are formatted with vector instructions when available.
+/// @param out The output buffer.
+/// @param seats The reservation of each seat, 0 if it is free.
+/// @param count Number of seats.
+/// @param last Character written after the last seat.
+/// @return 0 if the seats were appended successfully, 1 if writing failed.
+int out_seats(struct OutBuffer* out, const unsigned int* seats, size_t count, char last);
+
+/// Appends free seats to an output buffer, separated by spaces.
+/// @param out The output buffer.
+/// @param count Number of seats.
+/// @param last Character written after the last seat.
+/// @return 0 if the seats were appended successfully, 1 if writing failed.
+int out_zero_seats(struct OutBuffer* out, size_t count, char last);
+
+/// Writes everything in an output buffer to its file descriptor.
+/// @param out The output buffer.
+/// @return 0 if the buffer was written successfully, 1 otherwise.
+int out_flush(struct OutBuffer* out);
+
+#endif  // EMS_OUTBUF_H
@@ -8,12 +8,81 @@
 
 #include "constants.h"
 
+// Bytes read ahead from a file descriptor
+struct ReadBuffer {
+  size_t pos;                   // Next byte to be returned
+  size_t len;                   // Number of bytes in data
+  char data[READ_BUFFER_SIZE];  // Bytes read from the file descriptor
+};
+
+// Indexed by file descriptor, NULL until first read. Each descriptor is only read by one thread at a time.
+static struct ReadBuffer *read_buffers[MAX_BUFFERED_FDS];
+
+/// Reads from the given file descriptor through its buffer, so that the parser does not make a system call per byte.
+/// @param fd File descriptor to read from.
+/// @param buf Buffer to store the bytes in.
+/// @param len Number of bytes to read.
+/// @return Number of bytes read, less than len only at the end of the file, -1 on error.
+static ssize_t buffered_read(int fd, void *buf, size_t len) {
+  // Descriptors without a buffer slot are read directly
+  if (fd < 0 || fd >= MAX_BUFFERED_FDS) {
+    return read(fd, buf, len);
+  }
+
+  struct ReadBuffer *buffer = read_buffers[fd];
+  if (buffer == NULL) {
+    buffer = malloc(sizeof(struct ReadBuffer));
+    if (buffer == NULL) {
+      return read(fd, buf, len);
+    }
+
+    buffer->pos = buffer->len = 0;
+    read_buffers[fd] = buffer;
+  }
+
+  char *ptr = buf;
+  size_t done = 0;
+  while (done < len) {
+    if (buffer->pos == buffer->len) {
+      ssize_t read_bytes = read(fd, buffer->data, READ_BUFFER_SIZE);
+      if (read_bytes == -1) {
+        return done > 0 ? (ssize_t)done : -1;
+      } else if (read_bytes == 0) {
+        break;
+      }
+
+      buffer->pos = 0;
+      buffer->len = (size_t)read_bytes;
+    }
+
+    size_t count = buffer->len - buffer->pos;
+    if (count > len - done) {
+      count = len - done;
+    }
+
+    memcpy(ptr + done, buffer->data + buffer->pos, count);
+    buffer->pos += count;
+    done += count;
+  }
+
+  return (ssize_t)done;
+}
+
+void free_read_buffer(int fd) {
+  if (fd < 0 || fd >= MAX_BUFFERED_FDS) {
+    return;
+  }
+
+  free(read_buffers[fd]);
+  read_buffers[fd] = NULL;
+}
+
 static int read_uint(int fd, unsigned int *value, char *next) {
   char buf[16];
 
   int i = 0;
   while (1) {
-    if (read(fd, buf + i, 1) == 0) {
+    if (buffered_read(fd, buf + i, 1) == 0) {
       *next = '\0';
       break;
     }
@@ -41,20 +110,20 @@ static int read_uint(int fd, unsigned int *value, char *next) {
 
 void cleanup(int fd) {
   char ch;
-  while (read(fd, &ch, 1) == 1 && ch != '\n')
+  while (buffered_read(fd, &ch, 1) == 1 && ch != '\n')
     ;
 }
 
 enum Command get_next(int fd) {
   char buf[16];
 
-  if (read(fd, buf, 1) != 1) {
+  if (buffered_read(fd, buf, 1) != 1) {
     return EOC;
   }
 
   switch (buf[0]) {
     case 'C':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
+      if (buffered_read(fd, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -62,7 +131,7 @@ enum Command get_next(int fd) {
       return CMD_CREATE;
 
     case 'R':
-      if (read(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
+      if (buffered_read(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -70,7 +139,7 @@ enum Command get_next(int fd) {
       return CMD_RESERVE;
 
     case 'S':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
+      if (buffered_read(fd, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -78,12 +147,12 @@ enum Command get_next(int fd) {
       return CMD_SHOW;
 
     case 'L':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
+      if (buffered_read(fd, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
+      if (buffered_read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -91,12 +160,12 @@ enum Command get_next(int fd) {
       return CMD_LIST_EVENTS;
 
     case 'B':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
+      if (buffered_read(fd, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 7, 1) != 0 && buf[7] != '\n') {
+      if (buffered_read(fd, buf + 7, 1) != 0 && buf[7] != '\n') {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -104,7 +173,7 @@ enum Command get_next(int fd) {
       return CMD_BARRIER;
 
     case 'W':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
+      if (buffered_read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -112,12 +181,12 @@ enum Command get_next(int fd) {
       return CMD_WAIT;
 
     case 'H':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
+      if (buffered_read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
+      if (buffered_read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -170,14 +239,14 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || ch != '[') {
+  if (buffered_read(fd, &ch, 1) != 1 || ch != '[') {
     cleanup(fd);
     return 0;
   }
 
   size_t num_coords = 0;
   while (num_coords < max) {
-    if (read(fd, &ch, 1) != 1 || ch != '(') {
+    if (buffered_read(fd, &ch, 1) != 1 || ch != '(') {
       cleanup(fd);
       return 0;
     }
@@ -198,7 +267,7 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
 
     num_coords++;
 
-    if (read(fd, &ch, 1) != 1 || (ch != ' ' && ch != ']')) {
+    if (buffered_read(fd, &ch, 1) != 1 || (ch != ' ' && ch != ']')) {
       cleanup(fd);
       return 0;
     }
@@ -213,7 +282,7 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
+  if (buffered_read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
     cleanup(fd);
     return 0;
   }
@@ -18,6 +18,11 @@ enum Command {
 
 void cleanup(int fd);
 
+/// Frees the read buffer of a file descriptor, discarding any bytes left in it.
+/// @note Must be called before closing a file descriptor read by the parser.
+/// @param fd File descriptor.
+void free_read_buffer(int fd);
+
 /// Reads a line and returns the corresponding command.
 /// @param fd File descriptor to read from.
 /// @return The command read.
@@ -0,0 +1,461 @@
+#include "scheduler.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "operations.h"
+
+// Command waiting for the commands it depends on, or being run
+struct Task {
+  atomic_uint pending;  // Commands this one still waits for, plus one while it is being submitted
+  atomic_uint refs;     // References from the resource table, plus one until the task is done
+
+  pthread_mutex_t mutex;       // Mutex to protect done and the successors
+  int done;                    // Set once the command was run
+  struct Task* successors[3];  // Next task on each resource of this one, waiting for it
+  size_t num_successors;
+
+  enum Command cmd;
+  unsigned int event_id;
+  size_t num_rows, num_columns, num_coords;
+  size_t coords[];  // num_coords rows followed by num_coords columns
+};
+
+// Tasks ready to run, taken from the bottom by the owner thread and from the top by the others
+struct TaskDeque {
+  struct Task** tasks;  // Ring of MAX_PENDING_COMMANDS tasks, enough for every task submitted and not done
+  size_t head, count;
+  pthread_mutex_t mutex;
+};
+
+// Last task submitted on an event
+struct ResourceSlot {
+  unsigned int event_id;
+  struct Task* last;  // NULL while the slot is empty
+};
+
+struct Worker {
+  pthread_t thread_id;
+  int thread_num;
+  struct Scheduler* scheduler;
+  struct TaskDeque deque;
+  unsigned int pending_delay;  // Delay to wait before the next task, protected by the scheduler mutex
+  unsigned int barriers;       // Barriers the thread took part in
+};
+
+struct Scheduler {
+  struct Worker* workers;
+  int num_threads;
+  int output_fd;
+  int next_worker;  // Worker that gets the next task made ready by the parser
+
+  // Last task on each resource, only used by the thread submitting commands
+  struct ResourceSlot* events;  // Open addressing (linear probing) table of capacity slots
+  size_t events_capacity, events_count;
+  struct Task* last_output;    // Last SHOW or LIST
+  struct Task* last_registry;  // Last CREATE or LIST
+
+  pthread_mutex_t mutex;    // Mutex to protect the counters below and the pending delays
+  pthread_cond_t work;      // Signaled when a task is ready, a delay is added or the threads must stop
+  pthread_cond_t progress;  // Signaled when a task is done
+  size_t queued;            // Tasks in the deques
+  size_t outstanding;       // Tasks submitted and not done
+  int closing;              // Set when the threads must exit once every task is done
+  unsigned int barriers;    // Barriers reached by the thread submitting commands
+
+  pthread_barrier_t rendezvous;  // Meeting point of every thread and the thread submitting commands at a barrier
+};
+
+static void task_release(struct Task* task) {
+  if (atomic_fetch_sub(&task->refs, 1) == 1) {
+    pthread_mutex_destroy(&task->mutex);
+    free(task);
+  }
+}
+
+static void deque_push(struct TaskDeque* deque, struct Task* task) {
+  pthread_mutex_lock(&deque->mutex);
+  deque->tasks[(deque->head + deque->count) % MAX_PENDING_COMMANDS] = task;
+  deque->count++;
+  pthread_mutex_unlock(&deque->mutex);
+}
+
+static struct Task* deque_pop(struct TaskDeque* deque) {
+  struct Task* task = NULL;
+
+  pthread_mutex_lock(&deque->mutex);
+  if (deque->count > 0) {
+    deque->count--;
+    task = deque->tasks[(deque->head + deque->count) % MAX_PENDING_COMMANDS];
+  }
+  pthread_mutex_unlock(&deque->mutex);
+
+  return task;
+}
+
+static struct Task* deque_steal(struct TaskDeque* deque) {
+  struct Task* task = NULL;
+
+  pthread_mutex_lock(&deque->mutex);
+  if (deque->count > 0) {
+    task = deque->tasks[deque->head];
+    deque->head = (deque->head + 1) % MAX_PENDING_COMMANDS;
+    deque->count--;
+  }
+  pthread_mutex_unlock(&deque->mutex);
+
+  return task;
+}
+
+/// Queues a task that no longer waits for any other on a worker, and wakes a thread to run it.
+static void make_ready(struct Scheduler* scheduler, struct Worker* worker, struct Task* task) {
+  deque_push(&worker->deque, task);
+
+  pthread_mutex_lock(&scheduler->mutex);
+  scheduler->queued++;
+  pthread_cond_signal(&scheduler->work);
+  pthread_mutex_unlock(&scheduler->mutex);
+}
+
+/// Makes a task the last one on a resource, waiting for the previous last one unless it is already done.
+/// @note A task is only ever followed by one task on each of its (at most 3) resources.
+static void chain_resource(struct Task** last, struct Task* task) {
+  struct Task* before = *last;
+  if (before != NULL) {
+    pthread_mutex_lock(&before->mutex);
+    if (!before->done) {
+      before->successors[before->num_successors++] = task;
+      atomic_fetch_add(&task->pending, 1);
+    }
+    pthread_mutex_unlock(&before->mutex);
+
+    task_release(before);
+  }
+
+  atomic_fetch_add(&task->refs, 1);
+  *last = task;
+}
+
+/// Gets the slot of an event in the resource table, growing it when needed.
+/// @return Slot of the event, NULL on failure.
+static struct ResourceSlot* event_slot(struct Scheduler* scheduler, unsigned int event_id) {
+  if ((scheduler->events_count + 1) * 2 > scheduler->events_capacity) {
+    size_t capacity = scheduler->events_capacity ? scheduler->events_capacity * 2 : 64;
+    struct ResourceSlot* events = calloc(capacity, sizeof(struct ResourceSlot));
+    if (events == NULL) return NULL;
+
+    for (size_t i = 0; i < scheduler->events_capacity; i++) {
+      struct ResourceSlot* old = &scheduler->events[i];
+      if (old->last == NULL) continue;
+
+      size_t j = (old->event_id * 2654435769u) & (capacity - 1);
+      while (events[j].last != NULL) j = (j + 1) & (capacity - 1);
+      events[j] = *old;
+    }
+
+    free(scheduler->events);
+    scheduler->events = events;
+    scheduler->events_capacity = capacity;
+  }
+
+  size_t i = (event_id * 2654435769u) & (scheduler->events_capacity - 1);
+  while (scheduler->events[i].last != NULL && scheduler->events[i].event_id != event_id) {
+    i = (i + 1) & (scheduler->events_capacity - 1);
+  }
+
+  if (scheduler->events[i].last == NULL) {
+    scheduler->events[i].event_id = event_id;
+    scheduler->events_count++;
+  }
+
+  return &scheduler->events[i];
+}
+
+/// Forgets the last task of every resource.
+/// @note Only called while no task is outstanding, so that later tasks do not need to depend on them.
+static void clear_resources(struct Scheduler* scheduler) {
+  for (size_t i = 0; i < scheduler->events_capacity; i++) {
+    if (scheduler->events[i].last != NULL) {
+      task_release(scheduler->events[i].last);
+      scheduler->events[i].last = NULL;
+    }
+  }
+  scheduler->events_count = 0;
+
+  if (scheduler->last_output != NULL) task_release(scheduler->last_output);
+  if (scheduler->last_registry != NULL) task_release(scheduler->last_registry);
+  scheduler->last_output = scheduler->last_registry = NULL;
+}
+
+static void run_task(struct Worker* worker, struct Task* task) {
+  int output_fd = worker->scheduler->output_fd;
+  printf("Thread %d ran %u\n", worker->thread_num, task->cmd);
+
+  switch (task->cmd) {
+    case CMD_CREATE:
+      if (ems_create(task->event_id, task->num_rows, task->num_columns)) fprintf(stderr, "Failed to create event\n");
+      break;
+
+    case CMD_RESERVE:
+      if (ems_reserve(task->event_id, task->num_coords, task->coords, task->coords + task->num_coords))
+        fprintf(stderr, "Failed to reserve seats\n");
+      break;
+
+    case CMD_SHOW:
+      if (ems_show(output_fd, task->event_id)) fprintf(stderr, "Failed to show event\n");
+      break;
+
+    case CMD_LIST_EVENTS:
+      if (ems_list_events(output_fd)) fprintf(stderr, "Failed to list events\n");
+      break;
+
+    case CMD_BARRIER:
+    case CMD_WAIT:
+    case CMD_HELP:
+    case CMD_EMPTY:
+    case CMD_INVALID:
+    case EOC:
+      break;
+  }
+}
+
+/// Marks a task as done, running the tasks that were only waiting for it on the same worker.
+static void finish_task(struct Worker* worker, struct Task* task) {
+  struct Scheduler* scheduler = worker->scheduler;
+
+  pthread_mutex_lock(&task->mutex);
+  task->done = 1;
+  pthread_mutex_unlock(&task->mutex);
+
+  // No successor can be added once done is set
+  for (size_t i = 0; i < task->num_successors; i++) {
+    struct Task* successor = task->successors[i];
+    if (atomic_fetch_sub(&successor->pending, 1) == 1) make_ready(scheduler, worker, successor);
+  }
+
+  task_release(task);
+
+  pthread_mutex_lock(&scheduler->mutex);
+  scheduler->outstanding--;
+  pthread_cond_broadcast(&scheduler->progress);
+  if (scheduler->outstanding == 0) pthread_cond_broadcast(&scheduler->work);
+  pthread_mutex_unlock(&scheduler->mutex);
+}
+
+/// Takes a task from the worker's deque, or from the deque of another worker.
+static struct Task* take_task(struct Worker* worker) {
+  struct Scheduler* scheduler = worker->scheduler;
+
+  struct Task* task = deque_pop(&worker->deque);
+  for (int i = 1; task == NULL && i < scheduler->num_threads; i++) {
+    task = deque_steal(&scheduler->workers[(worker->thread_num - 1 + i) % scheduler->num_threads].deque);
+  }
+
+  if (task != NULL) {
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->queued--;
+    pthread_mutex_unlock(&scheduler->mutex);
+  }
+
+  return task;
+}
+
+static void* worker_function(void* args) {
+  struct Worker* worker = (struct Worker*)args;
+  struct Scheduler* scheduler = worker->scheduler;
+
+  while (1) {
+    pthread_mutex_lock(&scheduler->mutex);
+    while (worker->pending_delay == 0 && scheduler->queued == 0 &&
+           !((scheduler->closing || worker->barriers != scheduler->barriers) && scheduler->outstanding == 0)) {
+      pthread_cond_wait(&scheduler->work, &scheduler->mutex);
+    }
+
+    unsigned int delay = worker->pending_delay;
+    worker->pending_delay = 0;
+    int idle = delay == 0 && scheduler->queued == 0;
+    int barrier = idle && worker->barriers != scheduler->barriers;
+    if (barrier) worker->barriers++;
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    if (delay > 0) {
+      printf("Waiting...\n");
+      ems_wait(delay);
+      continue;
+    }
+
+    // Every task before the barrier is done, wait for the other threads to see it too
+    if (barrier) {
+      pthread_barrier_wait(&scheduler->rendezvous);
+      continue;
+    }
+
+    if (idle) return NULL;
+
+    struct Task* task = take_task(worker);
+    if (task == NULL) continue;  // Taken by another thread
+
+    run_task(worker, task);
+    finish_task(worker, task);
+  }
+}
+
+/// Waits for every task to be done and stops the first threads.
+/// @param scheduler Scheduler of the threads.
+/// @param num_threads Number of threads running.
+/// @return 0 if every thread was joined, 1 otherwise.
+static int join_workers(struct Scheduler* scheduler, int num_threads) {
+  pthread_mutex_lock(&scheduler->mutex);
+  scheduler->closing = 1;
+  pthread_cond_broadcast(&scheduler->work);
+  pthread_mutex_unlock(&scheduler->mutex);
+
+  int result = 0;
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_join(scheduler->workers[i].thread_id, NULL) != 0) {
+      fprintf(stderr, "Failed to join thread\n");
+      result = 1;
+    }
+  }
+
+  clear_resources(scheduler);
+  return result;
+}
+
+static int start_workers(struct Scheduler* scheduler) {
+  for (int i = 0; i < scheduler->num_threads; i++) {
+    struct Worker* worker = &scheduler->workers[i];
+    if (pthread_create(&worker->thread_id, NULL, worker_function, (void*)worker) != 0) {
+      fprintf(stderr, "Failed to create thread\n");
+      join_workers(scheduler, i);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void free_scheduler(struct Scheduler* scheduler) {
+  for (int i = 0; i < scheduler->num_threads; i++) {
+    pthread_mutex_destroy(&scheduler->workers[i].deque.mutex);
+    free(scheduler->workers[i].deque.tasks);
+  }
+
+  pthread_mutex_destroy(&scheduler->mutex);
+  pthread_cond_destroy(&scheduler->work);
+  pthread_cond_destroy(&scheduler->progress);
+  pthread_barrier_destroy(&scheduler->rendezvous);
+  free(scheduler->events);
+  free(scheduler->workers);
+  free(scheduler);
+}
+
+struct Scheduler* scheduler_create(int num_threads, int output_fd) {
+  struct Scheduler* scheduler = calloc(1, sizeof(struct Scheduler));
+  if (scheduler == NULL) return NULL;
+
+  scheduler->workers = calloc((size_t)num_threads, sizeof(struct Worker));
+  if (scheduler->workers == NULL || pthread_barrier_init(&scheduler->rendezvous, NULL, (unsigned int)num_threads + 1)) {
+    free(scheduler->workers);
+    free(scheduler);
+    return NULL;
+  }
+
+  scheduler->num_threads = num_threads;
+  scheduler->output_fd = output_fd;
+  pthread_mutex_init(&scheduler->mutex, NULL);
+  pthread_cond_init(&scheduler->work, NULL);
+  pthread_cond_init(&scheduler->progress, NULL);
+
+  int result = 0;
+  for (int i = 0; i < num_threads; i++) {
+    struct Worker* worker = &scheduler->workers[i];
+    worker->thread_num = i + 1;
+    worker->scheduler = scheduler;
+    worker->deque.tasks = malloc(MAX_PENDING_COMMANDS * sizeof(struct Task*));
+    pthread_mutex_init(&worker->deque.mutex, NULL);
+    result |= worker->deque.tasks == NULL;
+  }
+
+  if (result != 0 || start_workers(scheduler) != 0) {
+    free_scheduler(scheduler);
+    return NULL;
+  }
+
+  return scheduler;
+}
+
+int scheduler_submit(struct Scheduler* scheduler, const struct JobCommand* command) {
+  size_t num_coords = command->cmd == CMD_RESERVE ? command->num_coords : 0;
+  struct Task* task = malloc(sizeof(struct Task) + 2 * num_coords * sizeof(size_t));
+  struct ResourceSlot* slot = NULL;
+  if (task == NULL || (command->cmd != CMD_LIST_EVENTS && (slot = event_slot(scheduler, command->event_id)) == NULL)) {
+    fprintf(stderr, "Failed to allocate memory for command\n");
+    free(task);
+    return 1;
+  }
+
+  atomic_init(&task->pending, 1);
+  atomic_init(&task->refs, 1);
+  pthread_mutex_init(&task->mutex, NULL);
+  task->done = 0;
+  task->num_successors = 0;
+  task->cmd = command->cmd;
+  task->event_id = command->event_id;
+  task->num_rows = command->num_rows;
+  task->num_columns = command->num_columns;
+  task->num_coords = num_coords;
+  if (num_coords > 0) {  // Only a RESERVE has seats to point to
+    memcpy(task->coords, command->xs, num_coords * sizeof(size_t));
+    memcpy(task->coords + num_coords, command->ys, num_coords * sizeof(size_t));
+  }
+
+  pthread_mutex_lock(&scheduler->mutex);
+  while (scheduler->outstanding >= MAX_PENDING_COMMANDS) {
+    pthread_cond_wait(&scheduler->progress, &scheduler->mutex);
+  }
+  scheduler->outstanding++;
+  pthread_mutex_unlock(&scheduler->mutex);
+
+  if (slot != NULL) chain_resource(&slot->last, task);
+  if (task->cmd == CMD_SHOW || task->cmd == CMD_LIST_EVENTS) chain_resource(&scheduler->last_output, task);
+  if (task->cmd == CMD_CREATE || task->cmd == CMD_LIST_EVENTS) chain_resource(&scheduler->last_registry, task);
+
+  if (atomic_fetch_sub(&task->pending, 1) == 1) {
+    make_ready(scheduler, &scheduler->workers[scheduler->next_worker], task);
+    scheduler->next_worker = (scheduler->next_worker + 1) % scheduler->num_threads;
+  }
+
+  return 0;
+}
+
+void scheduler_delay(struct Scheduler* scheduler, unsigned int delay, unsigned int thread_id) {
+  pthread_mutex_lock(&scheduler->mutex);
+  for (int i = 0; i < scheduler->num_threads; i++) {
+    if (thread_id == 0 || thread_id == (unsigned int)i + 1) scheduler->workers[i].pending_delay += delay;
+  }
+
+  pthread_cond_broadcast(&scheduler->work);
+  pthread_mutex_unlock(&scheduler->mutex);
+}
+
+void scheduler_barrier(struct Scheduler* scheduler) {
+  pthread_mutex_lock(&scheduler->mutex);
+  scheduler->barriers++;
+  pthread_cond_broadcast(&scheduler->work);
+  pthread_mutex_unlock(&scheduler->mutex);
+
+  pthread_barrier_wait(&scheduler->rendezvous);
+
+  // No task is outstanding, so later tasks do not need to depend on the previous ones
+  clear_resources(scheduler);
+}
+
+int scheduler_destroy(struct Scheduler* scheduler) {
+  int result = join_workers(scheduler, scheduler->num_threads);
+  free_scheduler(scheduler);
+  return result;
+}
@@ -0,0 +1,52 @@
+#ifndef EMS_SCHEDULER_H
+#define EMS_SCHEDULER_H
+
+#include <stddef.h>
+
+#include "constants.h"
+#include "parser.h"
+
+// Command read from a job file
+struct JobCommand {
+  enum Command cmd;
+  unsigned int event_id;
+  size_t num_rows, num_columns, num_coords;
+  const size_t *xs, *ys;  // Seats of a RESERVE, in the parser buffers or in a mapped compiled job file
+  unsigned int delay, thread_id;
+};
+
+struct Scheduler;
+
+/// Creates a scheduler and starts its threads.
+/// @note Commands run in parallel unless they touch the same event, or both write to the output (SHOW and LIST) or
+/// both use the list of events (CREATE and LIST). Those run in the order they were submitted, so the output does not
+/// depend on the number of threads.
+/// @param num_threads Number of threads running the commands.
+/// @param output_fd File descriptor to write the output of the commands to.
+/// @return Newly created scheduler, NULL on failure.
+struct Scheduler* scheduler_create(int num_threads, int output_fd);
+
+/// Submits a CREATE, RESERVE, SHOW or LIST command to be run once the commands it depends on are done.
+/// @note Waits while too many commands are pending.
+/// @param scheduler Scheduler to run the command.
+/// @param command Command to run, copied by the scheduler along with its seats.
+/// @return 0 if the command was submitted, 1 otherwise.
+int scheduler_submit(struct Scheduler* scheduler, const struct JobCommand* command);
+
+/// Makes threads wait before running their next command.
+/// @param scheduler Scheduler of the threads.
+/// @param delay Delay in milliseconds.
+/// @param thread_id Thread that must wait (starting at 1), 0 for all of them.
+void scheduler_delay(struct Scheduler* scheduler, unsigned int delay, unsigned int thread_id);
+
+/// Waits for every submitted command to be done, meeting every thread once they are idle.
+/// @note The threads are kept running, they wait for the next commands after the barrier.
+/// @param scheduler Scheduler to wait for.
+void scheduler_barrier(struct Scheduler* scheduler);
+
+/// Waits for every submitted command to be done, stops the threads and frees the scheduler.
+/// @param scheduler Scheduler to destroy.
+/// @return 0 if the scheduler was destroyed successfully, 1 otherwise.
+int scheduler_destroy(struct Scheduler* scheduler);
+
+#endif  // EMS_SCHEDULER_H
@@ -1,310 +1,555 @@
 #include "api.h"
 
+#include <stdint.h>
 #include <stdio.h>
-
-int op_code(char op_code) {
-  if (write(req_pipe_fd, &op_code, sizeof(char)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    ems_quit();
-    return 1;
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "common/io.h"
+#include "common/protocol.h"
+
+int req_pipe_fd, resp_pipe_fd, server_pipe_fd;
+const char* req_pipe, *resp_pipe;
+int session_id;
+
+static uint32_t last_request_id = 0;
+
+// Shared memory of the session, NULL while the requests and responses go through the pipes
+static int shared_transport = 0;
+static struct SharedRings* rings = NULL;
+static char shm_name[MAX_PIPE_PATH_SIZE];  // Unlinked once the server mapped it, empty after that
+
+// Request sent to the server whose response was not received yet
+struct PendingRequest {
+  uint32_t request_id;
+  uint8_t op;
+  int out_fd;  // Where the output of a SHOW or LIST is printed
+};
+
+// The server answers the requests of a session in order, so the requests in flight are a queue. Its requests, at most
+// PIPELINE_DEPTH reservations, always fit in the request pipe, so the server is never blocked on a response that the
+// client can not read because it is blocked writing a request.
+static struct PendingRequest pending[PIPELINE_DEPTH];
+static size_t pending_head = 0, pending_count = 0;
+static size_t pipeline_depth = 1;
+
+// Commands gathered for the next BATCH, which is no larger than the largest request so that the queue of requests in
+// flight still fits in the request pipe
+static int batching = 0;
+static unsigned char batch[MAX_REQUEST_PAYLOAD - sizeof(size_t)];
+static size_t batch_size = 0, batch_count = 0;
+static int batch_out_fd = -1;  // Where the output of the SHOWs and LISTs of the batch is printed
+
+/// Message printed when a request fails while pipelining.
+/// @param op The operation of the request.
+/// @return The message.
+static const char* failure_message(uint8_t op) {
+  switch (op) {
+    case OP_CREATE:
+      return "Failed to create event";
+    case OP_RESERVE:
+      return "Failed to reserve seats";
+    case OP_SHOW:
+      return "Failed to show event";
+    case OP_LIST_EVENTS:
+      return "Failed to list events";
+    case OP_DELETE:
+      return "Failed to delete event";
+    case OP_BATCH:
+      return "Failed to run batch";
+    default:
+      return "Request failed";
   }
+}
 
-  if (write(req_pipe_fd, &session_id, sizeof(int)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    ems_quit();
+/// Receives the next field of a response.
+/// @param left Bytes of the response not received yet, updated.
+/// @param field Pointer to store the field in.
+/// @param size Size of the field.
+/// @return 0 if the field was received, 1 otherwise.
+static int recv_field(size_t* left, void* field, size_t size) {
+  if (size > *left || recv_payload(resp_pipe_fd, field, size)) {
+    fprintf(stderr, "Error reading from pipe\n");
     return 1;
   }
 
+  *left -= size;
   return 0;
 }
 
-/// Gets the index of a seat.
-/// @note This function assumes that the seat exists.
-/// @param num_cols Number of columns.
-/// @param row Row of the seat.
-/// @param col Column of the seat.
-/// @return Index of the seat.
-static size_t seat_index(size_t num_cols, size_t row, size_t col) { return (row - 1) * num_cols + col - 1; }
+/// Receives the result of a SHOW and prints the event.
+/// @param out_fd File descriptor to print the event to.
+/// @param left Bytes of the response not received yet, updated.
+/// @return The status of the result, -1 if it could not be received or printed.
+static int recv_show(int out_fd, size_t* left) {
+  int status;
+  if (recv_field(left, &status, sizeof(int))) {
+    return -1;
+  }
 
-int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path) {
-  // Create pipes and connect to the server
+  if (status != 0) {
+    return status;
+  }
 
-  unlink(req_pipe_path);
-  unlink(resp_pipe_path);
-  req_pipe = req_pipe_path;
-  resp_pipe = resp_pipe_path;
+  size_t num_rows, num_cols;
+  if (recv_field(left, &num_rows, sizeof(size_t)) || recv_field(left, &num_cols, sizeof(size_t))) {
+    return -1;
+  }
 
-  if (mkfifo(req_pipe_path, 0777) == -1) {
-    fprintf(stderr, "Error creating request pipe\n");
-    return 1;
+  // Width of each tile (0 if it has no reservations) followed by the seats of the tiles with reservations
+  size_t num_seats = num_rows * num_cols;
+  size_t num_tiles = (num_seats + SEAT_TILE_SIZE - 1) / SEAT_TILE_SIZE;
+  if (num_tiles > *left) {
+    fprintf(stderr, "Error reading from pipe\n");
+    return -1;
   }
 
-  if (mkfifo(resp_pipe_path, 0777) == -1) {
-    fprintf(stderr, "Error creating response pipe\n");
-    return 1;
+  unsigned char* widths = malloc(num_tiles + 1);
+  if (widths == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    return -1;
   }
 
-  // open server pipe
-  server_pipe_fd = open(server_pipe_path, O_WRONLY);
-  if (server_pipe_fd == -1) {
-    fprintf(stderr, "Error opening server pipe\n");
-    return 1;
+  if (recv_field(left, widths, num_tiles)) {
+    free(widths);
+    return -1;
   }
 
-  char buffer[82];
-  memset(buffer, 0, sizeof(char) * 82);
-  char op_code = '1';
-  memcpy(buffer, &op_code, sizeof(char));
-  memcpy(buffer + sizeof(char), req_pipe_path, sizeof(char) * MAX_PIPE_PATH_SIZE);
-  memcpy(buffer + sizeof(char) * (MAX_PIPE_PATH_SIZE + 1), resp_pipe_path, sizeof(char) * MAX_PIPE_PATH_SIZE);
+  unsigned char seats[SEAT_TILE_SIZE * sizeof(uint32_t)];
+  struct OutBuffer out;
+  out_init(&out, out_fd);
 
-  if (write(server_pipe_fd, buffer, sizeof(char) * (MAX_PIPE_PATH_SIZE * 2 + 1)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    ems_quit();
-    return 1;
+  for (size_t t = 0; t < num_tiles; t++) {
+    size_t tile_seats = num_seats - t * SEAT_TILE_SIZE < SEAT_TILE_SIZE ? num_seats - t * SEAT_TILE_SIZE : SEAT_TILE_SIZE;
+    unsigned char width = widths[t];
+
+    if (width != 0 && width != 1 && width != 2 && width != 4) {
+      fprintf(stderr, "Error reading from pipe\n");
+      free(widths);
+      return -1;
+    }
+
+    if (width != 0 && recv_field(left, seats, width * tile_seats)) {
+      free(widths);
+      return -1;
+    }
+
+    if (out_seat_tile(&out, seats, width, t * SEAT_TILE_SIZE, tile_seats, num_cols)) {
+      fprintf(stderr, "Error writing to file\n");
+      free(widths);
+      return -1;
+    }
   }
 
-  req_pipe_fd = open(req_pipe_path, O_WRONLY);
-  if (req_pipe_fd == -1) {
-    fprintf(stderr, "Error opening request pipe\n");
-    ems_quit();
-    return 1;
+  free(widths);
+
+  if (out_flush(&out)) {
+    fprintf(stderr, "Error writing to file\n");
+    return -1;
   }
 
-  resp_pipe_fd = open(resp_pipe_path, O_RDONLY);
-  if (resp_pipe_fd == -1) {
-    fprintf(stderr, "Error opening response pipe\n");
-    ems_quit();
-    return 1;
+  return 0;
+}
+
+/// Receives the result of a LIST and prints the events.
+/// @param out_fd File descriptor to print the events to.
+/// @param left Bytes of the response not received yet, updated.
+/// @return The status of the result, -1 if it could not be received or printed.
+static int recv_list(int out_fd, size_t* left) {
+  int status;
+  if (recv_field(left, &status, sizeof(int))) {
+    return -1;
+  }
+
+  if (status != 0) {
+    return status;
   }
 
-  if (read(resp_pipe_fd, &session_id, sizeof(int)) == -1) {
+  size_t num_events;
+  if (recv_field(left, &num_events, sizeof(size_t))) {
+    return -1;
+  }
+
+  if (num_events > *left / sizeof(unsigned int)) {
     fprintf(stderr, "Error reading from pipe\n");
-    ems_quit();
-    return 1;
+    return -1;
   }
 
-  return 0;
-}
+  struct OutBuffer out;
+  out_init(&out, out_fd);
 
-int ems_quit(void) { 
-  // Close pipes and disconnect from the server
+  // The ids are read in small batches, the whole list is never held by the client
+  unsigned int events[256];
+  for (size_t i = 0; i < num_events;) {
+    size_t count = num_events - i < 256 ? num_events - i : 256;
+    if (recv_field(left, events, sizeof(unsigned int) * count)) {
+      return -1;
+    }
 
-  op_code('2');
+    for (size_t j = 0; j < count; j++, i++) {
+      if (out_str(&out, "Event: ") || out_uint(&out, events[j]) || out_str(&out, "\n")) {
+        fprintf(stderr, "Error writing to file\n");
+        return -1;
+      }
+    }
+  }
 
-  close(req_pipe_fd);
-  close(resp_pipe_fd);
-  close(server_pipe_fd);
+  if (out_flush(&out)) {
+    fprintf(stderr, "Error writing to file\n");
+    return -1;
+  }
 
-  unlink(req_pipe);
-  unlink(resp_pipe);
   return 0;
 }
 
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
-  //TODO: send create request to the server (through the request pipe) and wait for the response (through the response pipe)
-  if (op_code('3') == 1) {
-    return 1;
-  }
+static int recv_result(uint8_t op, int out_fd, size_t* left);
 
-  if (write(req_pipe_fd, &event_id, sizeof(unsigned int)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    ems_quit();
-    return 1;
+/// Receives the results of a BATCH, printing the output of its SHOWs and LISTs and the failures of its commands.
+/// @param out_fd File descriptor to print the output of the SHOWs and LISTs to.
+/// @param left Bytes of the response not received yet, updated.
+/// @return The status of the batch, -1 if it could not be received or printed.
+static int recv_batch(int out_fd, size_t* left) {
+  int status;
+  size_t num_results;
+  if (recv_field(left, &status, sizeof(int))) {
+    return -1;
   }
 
-  if (write(req_pipe_fd, &num_rows, sizeof(size_t)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    ems_quit();
-    return 1;
+  if (status != 0) {
+    return status;
   }
 
-  if (write(req_pipe_fd, &num_cols, sizeof(size_t)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    ems_quit();
-    return 1;
+  if (recv_field(left, &num_results, sizeof(size_t))) {
+    return -1;
   }
 
-  int response;
-  if (read(resp_pipe_fd, &response, sizeof(int)) == -1) {
-    fprintf(stderr, "Error reading from pipe\n");
-    ems_quit();
-    return 1;
+  for (size_t i = 0; i < num_results; i++) {
+    uint8_t op;
+    if (recv_field(left, &op, sizeof(uint8_t))) {
+      return -1;
+    }
+
+    // Batches are not nested
+    int result = op == OP_BATCH ? -1 : recv_result(op, out_fd, left);
+    if (result == -1) {
+      return -1;
+    }
+
+    if (result != 0) {
+      fprintf(stderr, "%s\n", failure_message(op));
+    }
   }
 
   return 0;
 }
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
-  //TODO: send reserve request to the server (through the request pipe) and wait for the response (through the response pipe)
-  // (char) OP_CODE=4 | (unsigned int) event_id | (size_t) num_seats | (size_t[num_seats]) conteúdo de xs | (size_t[num_seats]) conteúdo de ys
+/// Receives the result of a request, printing the output of a SHOW, LIST or BATCH.
+/// @param op The operation of the request.
+/// @param out_fd File descriptor to print the output to.
+/// @param left Bytes of the response not received yet, updated.
+/// @return The status of the result, -1 if it could not be received or printed.
+static int recv_result(uint8_t op, int out_fd, size_t* left) {
+  int status;
+  switch (op) {
+    case OP_SHOW:
+      return recv_show(out_fd, left);
 
-  if (op_code('4') == 1) {
-    return 1;
+    case OP_LIST_EVENTS:
+      return recv_list(out_fd, left);
+
+    case OP_BATCH:
+      return recv_batch(out_fd, left);
+
+    default:
+      return recv_field(left, &status, sizeof(int)) ? -1 : status;
   }
+}
 
-  if (write(req_pipe_fd, &event_id, sizeof(unsigned int)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
+/// Receives the response to the oldest request in flight, printing the output of a SHOW, LIST or BATCH.
+/// @return The status of the response, 1 if it was not received (the session is closed).
+static int complete_oldest(void) {
+  struct PendingRequest request = pending[pending_head];
+  pending_head = (pending_head + 1) % PIPELINE_DEPTH;
+  pending_count--;
+
+  struct FrameHeader response;
+  if (recv_header(resp_pipe_fd, &response) || response.op != request.op || response.request_id != request.request_id) {
+    fprintf(stderr, "Error reading from pipe\n");
     ems_quit();
     return 1;
   }
 
-  if (write(req_pipe_fd, &num_seats, sizeof(size_t)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
+  size_t left = response.length;
+  int status = recv_result(request.op, request.out_fd, &left);
+  if (status == -1 || left != 0) {
+    if (status != -1) fprintf(stderr, "Error reading from pipe\n");
     ems_quit();
     return 1;
   }
 
-  if (write(req_pipe_fd, xs, sizeof(size_t) * num_seats) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    ems_quit();
-    return 1;
+  // Without pipelining the status is returned to the caller of the request, which reports it
+  if (status != 0 && pipeline_depth > 1) {
+    fprintf(stderr, "%s\n", failure_message(request.op));
   }
 
-  if (write(req_pipe_fd, ys, sizeof(size_t) * num_seats) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    ems_quit();
-    return 1;
+  return status;
+}
+
+/// Sends a request, first receiving the oldest response if pipeline_depth requests are in flight.
+/// @param op The operation of the request.
+/// @param payload The parts of the payload of the request.
+/// @param count Number of parts of the payload.
+/// @param out_fd File descriptor to print the output of a SHOW or LIST to.
+/// @return Without pipelining, the status of the response. Otherwise, 0 if the request was sent and 1 if it was not.
+static int submit(uint8_t op, const struct iovec* payload, int count, int out_fd) {
+  if (pending_count == pipeline_depth) {
+    complete_oldest();
   }
 
-  int response;
-  if (read(resp_pipe_fd, &response, sizeof(int)) == -1) {
-    fprintf(stderr, "Error reading from pipe\n");
+  uint32_t request_id = ++last_request_id;
+  if (send_frame(req_pipe_fd, op, request_id, session_id, payload, count)) {
+    fprintf(stderr, "Error writing to pipe\n");
     ems_quit();
     return 1;
   }
 
-  return 0;
+  pending[(pending_head + pending_count) % PIPELINE_DEPTH] =
+      (struct PendingRequest){.request_id = request_id, .op = op, .out_fd = out_fd};
+  pending_count++;
+
+  return pipeline_depth == 1 ? complete_oldest() : 0;
 }
 
-int ems_show(int out_fd, unsigned int event_id) {
-  //TODO: send show request to the server (through the request pipe) and wait for the response (through the response pipe)
-  if (op_code('5') == 1) {
-    return 1;
+/// Sends the commands gathered so far as a BATCH.
+/// @return 0 if there were no commands, otherwise like submit.
+static int flush_batch(void) {
+  if (batch_count == 0) {
+    return 0;
   }
 
-  if (write(req_pipe_fd, &event_id, sizeof(unsigned int)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    ems_quit();
-    return 1;
+  size_t count = batch_count;
+  struct iovec payload[] = {{.iov_base = &count, .iov_len = sizeof(size_t)},
+                            {.iov_base = batch, .iov_len = batch_size}};
+  int out_fd = batch_out_fd;
+  batch_size = batch_count = 0;
+  batch_out_fd = -1;
+  return submit(OP_BATCH, payload, 2, out_fd);
+}
+
+/// Sends a request, or adds it to the next BATCH while batching.
+/// @param op The operation of the request.
+/// @param payload The parts of the payload of the request.
+/// @param count Number of parts of the payload.
+/// @param out_fd File descriptor to print the output of a SHOW or LIST to, -1 for other requests.
+/// @return Like submit, 0 if the request was added to the batch.
+static int request(uint8_t op, const struct iovec* payload, int count, int out_fd) {
+  size_t size = sizeof(uint8_t);
+  for (int i = 0; i < count; i++) {
+    size += payload[i].iov_len;
   }
 
-  int response;
-  if (read(resp_pipe_fd, &response, sizeof(int)) == -1) {
-    fprintf(stderr, "Error reading from pipe\n");
-    ems_quit();
-    return 1;
+  // DELETE is not batched, and neither is a request that does not fit in a batch of its own
+  if (!batching || op == OP_DELETE || size > sizeof(batch)) {
+    flush_batch();
+    return submit(op, payload, count, out_fd);
   }
 
-  if (response == 1) {
-    return 1;
+  if (batch_count == MAX_BATCH_COMMANDS || batch_size + size > sizeof(batch) ||
+      (out_fd != -1 && batch_out_fd != -1 && out_fd != batch_out_fd)) {
+    flush_batch();
   }
 
-  size_t num_rows, num_cols;
+  batch[batch_size++] = op;
+  for (int i = 0; i < count; i++) {
+    memcpy(batch + batch_size, payload[i].iov_base, payload[i].iov_len);
+    batch_size += payload[i].iov_len;
+  }
 
-  if (read(resp_pipe_fd, &num_rows, sizeof(size_t)) == -1) {
-    fprintf(stderr, "Error reading from pipe\n");
-    ems_quit();
-    return 1;
+  if (out_fd != -1) {
+    batch_out_fd = out_fd;
   }
 
-  if (read(resp_pipe_fd, &num_cols, sizeof(size_t)) == -1) {
-    fprintf(stderr, "Error reading from pipe\n");
-    ems_quit();
-    return 1;
+  batch_count++;
+  return 0;
+}
+
+int ems_pipeline(size_t depth) {
+  int result = ems_drain();
+  pipeline_depth = depth < 1 ? 1 : depth > PIPELINE_DEPTH ? PIPELINE_DEPTH : depth;
+  return result;
+}
+
+int ems_batching(int enable) {
+  int result = flush_batch();
+  batching = enable;
+  return result;
+}
+
+int ems_drain(void) {
+  int result = flush_batch();
+  while (pending_count > 0) {
+    if (complete_oldest()) {
+      result = 1;
+    }
   }
 
-  unsigned int seats[num_rows * num_cols];
+  return result;
+}
 
-  if (read(resp_pipe_fd, seats, sizeof(unsigned int) * num_rows * num_cols) == -1) {
-    fprintf(stderr, "Error reading from pipe\n");
-    ems_quit();
+void ems_shared_transport(int enable) { shared_transport = enable; }
+
+int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path) {
+  // Create pipes and connect to the server
+
+  unlink(req_pipe_path);
+  unlink(resp_pipe_path);
+  req_pipe = req_pipe_path;
+  resp_pipe = resp_pipe_path;
+
+  if (mkfifo(req_pipe_path, 0777) == -1) {
+    fprintf(stderr, "Error creating request pipe\n");
     return 1;
   }
 
-  for (size_t i = 1; i <= num_rows; i++) {
-    for (size_t j = 1; j <= num_cols; j++) {
-      char seat_str[2];
-
-      sprintf(seat_str, "%u", seats[seat_index(num_cols, i, j)]);
-      if (write(out_fd, seat_str, 1) == -1) {
-        fprintf(stderr, "Error writing to file\n");
-        ems_quit();
-        return 1;
-      }
+  if (mkfifo(resp_pipe_path, 0777) == -1) {
+    fprintf(stderr, "Error creating response pipe\n");
+    return 1;
+  }
 
-      if (j < num_cols) {
-        if (write(out_fd, " ", 1) == -1) {
-          fprintf(stderr, "Error writing to file\n");
-          ems_quit();
-          return 1;
-        }
-      }
-    }
+  // open server pipe
+  server_pipe_fd = open(server_pipe_path, O_WRONLY);
+  if (server_pipe_fd == -1) {
+    fprintf(stderr, "Error opening server pipe\n");
+    return 1;
+  }
 
-    if (write(out_fd, "\n", 1) == -1) {
-      fprintf(stderr, "Error writing to file\n");
-      ems_quit();
-      return 1;
+  // A client is a single session, so the shared memory is named after the process
+  if (shared_transport) {
+    snprintf(shm_name, sizeof(shm_name), "/ems-%d", (int)getpid());
+    shm_unlink(shm_name);
+    rings = shared_rings_create(shm_name);
+    if (rings == NULL) {
+      fprintf(stderr, "Error creating shared memory, using the pipes\n");
+      shm_name[0] = '\0';
     }
   }
 
-  return 0;
-}
+  // The request is smaller than PIPE_BUF, so it is not interleaved with the requests of other clients
+  char paths[3 * MAX_PIPE_PATH_SIZE];
+  memset(paths, 0, sizeof(paths));
+  strncpy(paths, req_pipe_path, MAX_PIPE_PATH_SIZE);
+  strncpy(paths + MAX_PIPE_PATH_SIZE, resp_pipe_path, MAX_PIPE_PATH_SIZE);
+  strncpy(paths + 2 * MAX_PIPE_PATH_SIZE, shm_name, MAX_PIPE_PATH_SIZE);
 
-int ems_list_events(int out_fd) {
-  //TODO: send list request to the server (through the request pipe) and wait for the response (through the response pipe)
-  if (op_code('6') == 1) {
+  struct iovec payload = {.iov_base = paths, .iov_len = rings != NULL ? sizeof(paths) : 2 * MAX_PIPE_PATH_SIZE};
+  uint32_t request_id = ++last_request_id;
+  if (send_frame(server_pipe_fd, OP_SETUP, request_id, 0, &payload, 1)) {
+    fprintf(stderr, "Error writing to pipe\n");
+    ems_quit();
     return 1;
   }
 
-  int response;
-  if (read(resp_pipe_fd, &response, sizeof(int)) == -1) {
-    fprintf(stderr, "Error reading from pipe\n");
+  req_pipe_fd = open(req_pipe_path, O_WRONLY);
+  if (req_pipe_fd == -1) {
+    fprintf(stderr, "Error opening request pipe\n");
     ems_quit();
     return 1;
   }
 
-  if (response == 1) {
+  resp_pipe_fd = open(resp_pipe_path, O_RDONLY);
+  if (resp_pipe_fd == -1) {
+    fprintf(stderr, "Error opening response pipe\n");
+    ems_quit();
     return 1;
   }
 
-  size_t num_events;
-  if (read(resp_pipe_fd, &num_events, sizeof(size_t)) == -1) {
+  struct FrameHeader response;
+  int shared;
+  if (recv_header(resp_pipe_fd, &response) || response.op != OP_SETUP || response.request_id != request_id ||
+      response.length != sizeof(int) || recv_payload(resp_pipe_fd, &shared, sizeof(int))) {
     fprintf(stderr, "Error reading from pipe\n");
     ems_quit();
     return 1;
   }
 
-  unsigned int events[num_events];
-  if (read(resp_pipe_fd, events, sizeof(unsigned int) * num_events) == -1) {
-    fprintf(stderr, "Error reading from pipe\n");
+  session_id = response.session_id;
+
+  // The server mapped the shared memory or never will, so its name is not needed anymore
+  if (shm_name[0] != '\0') {
+    shm_unlink(shm_name);
+    shm_name[0] = '\0';
+  }
+
+  if (rings != NULL && !shared) {
+    shared_rings_close(rings);
+    rings = NULL;
+  }
+
+  if (rings != NULL &&
+      (attach_ring(req_pipe_fd, &rings->requests) || attach_ring(resp_pipe_fd, &rings->responses))) {
+    fprintf(stderr, "Error attaching shared memory\n");
     ems_quit();
     return 1;
   }
 
-  for (size_t i = 0; i < num_events; i++) {
-    char event_str[11];
-    sprintf(event_str, "%u", events[i]);
+  return 0;
+}
 
-    if (write(out_fd, "Event: ", 7) == -1) {
-      fprintf(stderr, "Error writing to file\n");
-      ems_quit();
-      return 1;
-    }
+int ems_quit(void) { 
+  // Close pipes and disconnect from the server
 
-    if (write(out_fd, event_str, 1) == -1) {
-      fprintf(stderr, "Error writing to file\n");
-      ems_quit();
-      return 1;
-    }
+  // The requests not sent yet and the responses to the requests still in flight are dropped
+  send_frame(req_pipe_fd, OP_QUIT, ++last_request_id, session_id, NULL, 0);
+  pending_count = 0;
+  batch_size = batch_count = 0;
+  batch_out_fd = -1;
 
-    if (write(out_fd, "\n", 1) == -1) {
-      fprintf(stderr, "Error writing to file\n");
-      ems_quit();
-      return 1;
-    }
+  free_read_buffer(resp_pipe_fd);
+  if (rings != NULL) {
+    detach_ring(req_pipe_fd);
+    detach_ring(resp_pipe_fd);
+    shared_rings_close(rings);
+    rings = NULL;
+  }
+
+  if (shm_name[0] != '\0') {
+    shm_unlink(shm_name);
+    shm_name[0] = '\0';
   }
 
+  close(req_pipe_fd);
+  close(resp_pipe_fd);
+  close(server_pipe_fd);
+  req_pipe_fd = resp_pipe_fd = server_pipe_fd = -1;
+
+  unlink(req_pipe);
+  unlink(resp_pipe);
   return 0;
 }
+
+int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
+  struct iovec payload[] = {{.iov_base = &event_id, .iov_len = sizeof(unsigned int)},
+                            {.iov_base = &num_rows, .iov_len = sizeof(size_t)},
+                            {.iov_base = &num_cols, .iov_len = sizeof(size_t)}};
+  return request(OP_CREATE, payload, 3, -1);
+}
+
+int ems_reserve(unsigned int event_id, size_t num_seats, const size_t* xs, const size_t* ys) {
+  struct iovec payload[] = {{.iov_base = &event_id, .iov_len = sizeof(unsigned int)},
+                            {.iov_base = &num_seats, .iov_len = sizeof(size_t)},
+                            {.iov_base = (void*)xs, .iov_len = sizeof(size_t) * num_seats},
+                            {.iov_base = (void*)ys, .iov_len = sizeof(size_t) * num_seats}};
+  return request(OP_RESERVE, payload, 4, -1);
+}
+
+int ems_delete(unsigned int event_id) {
+  struct iovec payload = {.iov_base = &event_id, .iov_len = sizeof(unsigned int)};
+  return request(OP_DELETE, &payload, 1, -1);
+}
+
+int ems_show(int out_fd, unsigned int event_id) {
+  struct iovec payload = {.iov_base = &event_id, .iov_len = sizeof(unsigned int)};
+  return request(OP_SHOW, &payload, 1, out_fd);
+}
+
+int ems_list_events(int out_fd) { return request(OP_LIST_EVENTS, NULL, 0, out_fd); }
@@ -10,11 +10,9 @@
 #include "common/constants.h"
 
 /// Global variables that stores the file descriptor of the request pipe.
-int req_pipe_fd, resp_pipe_fd, server_pipe_fd;
-const char* req_pipe, *resp_pipe;
-int session_id;
-
-int op_code(char op_code);
+extern int req_pipe_fd, resp_pipe_fd, server_pipe_fd;
+extern const char* req_pipe, *resp_pipe;
+extern int session_id;
 
 /// Connects to an EMS server.
 /// @param req_pipe_path Path to the name pipe to be created for requests.
@@ -23,7 +21,34 @@ int op_code(char op_code);
 /// @return 0 if the connection was established successfully, 1 otherwise.
 int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path);
 
+/// Makes the next ems_setup ask the server to send the requests and responses through shared memory.
+/// @note The pipes are still used, to wake up an idle server and to tell each side when the other one is gone. The
+/// server falls back to the pipes if it can not map the shared memory.
+/// @param enable 1 to use shared memory, 0 to use the pipes.
+void ems_shared_transport(int enable);
+
+/// Sets how many requests can be in flight at once, after receiving the responses to the requests in flight.
+/// @note With a depth of 1, the default, each request waits for its response and returns its status. With a larger
+/// depth, requests return once they are sent, and their failures are printed to stderr when their responses arrive.
+/// The output of SHOW and LIST is printed in the order of the requests either way.
+/// @param depth Number of requests in flight, at most PIPELINE_DEPTH.
+/// @return 0 if every request in flight succeeded, 1 otherwise.
+int ems_pipeline(size_t depth);
+
+/// Groups the CREATE, RESERVE, SHOW and LIST requests that follow into BATCH requests, each run by the server with its
+/// locks taken once, after sending the requests gathered so far.
+/// @note While batching, requests return once they are added to a batch, and their failures are printed to stderr
+/// when the response to their batch arrives. A batch is sent when it is full, before a DELETE and by ems_drain.
+/// @param enable 1 to start batching, 0 to stop.
+/// @return Like the requests, the status of the last batch sent or whether it was sent.
+int ems_batching(int enable);
+
+/// Sends the requests gathered in a batch and receives the responses to all the requests in flight.
+/// @return 0 if every request in flight succeeded, 1 otherwise.
+int ems_drain(void);
+
 /// Disconnects from an EMS server.
+/// @note The responses to the requests in flight are dropped, see ems_drain.
 /// @return 0 in case of success, 1 otherwise.
 int ems_quit(void);
 
@@ -40,7 +65,12 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
 /// @param xs Array of rows of the seats to reserve.
 /// @param ys Array of columns of the seats to reserve.
 /// @return 0 if the reservation was created successfully, 1 otherwise.
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys);
+int ems_reserve(unsigned int event_id, size_t num_seats, const size_t* xs, const size_t* ys);
+
+/// Deletes the event with the given id.
+/// @param event_id Id of the event to be deleted.
+/// @return 0 if the event was deleted successfully, 1 otherwise.
+int ems_delete(unsigned int event_id);
 
 /// Prints the given event to the given file.
 /// @param out_fd File descriptor to print the event to.
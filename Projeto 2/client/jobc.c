@@ -0,0 +1,145 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/constants.h"
+#include "common/io.h"
+#include "common/jobfile.h"
+#include "parser.h"
+
+/// Writes a record, followed by the seats of a RESERVE.
+/// @param out File to write to.
+/// @param record Record to write.
+/// @param xs Rows of the seats of a RESERVE.
+/// @param ys Columns of the seats of a RESERVE.
+/// @return 0 if the record was written successfully, 1 otherwise.
+static int write_record(FILE* out, const struct JobRecord* record, const size_t* xs, const size_t* ys) {
+  size_t num_coords = (size_t)record->num_coords;
+  return fwrite(record, sizeof(*record), 1, out) != 1 || fwrite(xs, sizeof(size_t), num_coords, out) != num_coords ||
+         fwrite(ys, sizeof(size_t), num_coords, out) != num_coords;
+}
+
+/// Compiles the commands of a job file into records.
+/// @param in_fd File descriptor of the job file.
+/// @param out File to write the records to.
+/// @return 0 if the job file was compiled successfully, 1 otherwise.
+static int compile(int in_fd, FILE* out) {
+  struct JobHeader header = {.version = JOBC_VERSION};
+  memcpy(header.magic, JOBC_MAGIC, sizeof(header.magic));
+  if (fwrite(&header, sizeof(header), 1, out) != 1) return 1;
+
+  size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+
+  while (1) {
+    struct JobRecord record = {0};
+    unsigned int delay = 0;
+    size_t num_rows, num_columns;
+
+    // Invalid commands are kept, so that running the compiled file reports them like running the job file
+    switch (get_next(in_fd)) {
+      case CMD_CREATE:
+        record.op = JOB_CREATE;
+        if (parse_create(in_fd, &record.event_id, &num_rows, &num_columns) != 0) {
+          record.op = JOB_INVALID;
+          break;
+        }
+
+        record.arg1 = num_rows;
+        record.arg2 = num_columns;
+        break;
+
+      case CMD_RESERVE:
+        record.op = JOB_RESERVE;
+        record.num_coords = parse_reserve(in_fd, MAX_RESERVATION_SIZE, &record.event_id, xs, ys);
+        if (record.num_coords == 0) record.op = JOB_INVALID;
+        break;
+
+      case CMD_SHOW:
+        record.op = JOB_SHOW;
+        if (parse_show(in_fd, &record.event_id) != 0) record.op = JOB_INVALID;
+        break;
+
+      case CMD_LIST_EVENTS:
+        record.op = JOB_LIST_EVENTS;
+        break;
+
+      case CMD_DELETE:
+        record.op = JOB_DELETE;
+        if (parse_delete(in_fd, &record.event_id) != 0) record.op = JOB_INVALID;
+        break;
+
+      case CMD_WAIT:
+        record.op = JOB_WAIT;
+        if (parse_wait(in_fd, &delay, NULL) == -1) {
+          record.op = JOB_INVALID;
+          break;
+        }
+
+        record.arg1 = delay;
+        break;
+
+      case CMD_HELP:
+        record.op = JOB_HELP;
+        break;
+
+      case CMD_INVALID:
+        record.op = JOB_INVALID;
+        break;
+
+      case CMD_EMPTY:
+        continue;
+
+      case EOC:
+        return 0;
+    }
+
+    if (write_record(out, &record, xs, ys)) return 1;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <.jobs file path> [.jobc file path]\n", argv[0]);
+    return 1;
+  }
+
+  char out_path[PATH_MAX];
+  if (argc > 2) {
+    snprintf(out_path, PATH_MAX, "%s", argv[2]);
+  } else {
+    const char* dot = strrchr(argv[1], '.');
+    size_t length = dot != NULL ? (size_t)(dot - argv[1]) : strlen(argv[1]);
+    if (length + strlen(".jobc") >= PATH_MAX) {
+      fprintf(stderr, "The provided .jobs file path is too long. Path: %s\n", argv[1]);
+      return 1;
+    }
+    snprintf(out_path, PATH_MAX, "%.*s.jobc", (int)length, argv[1]);
+  }
+
+  int in_fd = open(argv[1], O_RDONLY);
+  if (in_fd == -1) {
+    fprintf(stderr, "Failed to open input file. Path: %s\n", argv[1]);
+    return 1;
+  }
+
+  FILE* out = fopen(out_path, "wb");
+  if (out == NULL) {
+    fprintf(stderr, "Failed to open output file. Path: %s\n", out_path);
+    close(in_fd);
+    return 1;
+  }
+
+  int result = compile(in_fd, out);
+  free_read_buffer(in_fd);
+  close(in_fd);
+
+  if (fclose(out) != 0) result = 1;
+  if (result != 0) {
+    fprintf(stderr, "Failed to write output file. Path: %s\n", out_path);
+    unlink(out_path);
+  }
+
+  return result;
+}
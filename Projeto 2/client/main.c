@@ -1,20 +1,103 @@
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "api.h"
 #include "common/constants.h"
+#include "common/io.h"
+#include "common/jobfile.h"
 #include "parser.h"
 
+static void print_help(void) {
+  printf(
+      "Available commands:\n"
+      "  CREATE <event_id> <num_rows> <num_columns>\n"
+      "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
+      "  SHOW <event_id>\n"
+      "  DELETE <event_id>\n"
+      "  LIST\n"
+      "  WAIT <delay_ms>\n"
+      "  HELP\n");
+}
+
+/// Runs the records of a compiled job file, mapped in memory so that nothing is parsed.
+/// @param in_fd File descriptor of the compiled job file.
+/// @param out_fd File descriptor to print the output of the commands to.
+/// @return 0 if the file was run, 1 if it is not a valid compiled job file.
+static int run_compiled(int in_fd, int out_fd) {
+  struct CompiledJob job;
+  if (jobfile_map(in_fd, &job)) {
+    fprintf(stderr, "Invalid compiled job file\n");
+    return 1;
+  }
+
+  const struct JobRecord* record;
+  const size_t *xs = NULL, *ys = NULL;
+  int next;
+  while ((next = jobfile_next(&job, &record, &xs, &ys)) == 1) {
+    switch ((enum JobOp)record->op) {
+      case JOB_CREATE:
+        if (ems_create(record->event_id, (size_t)record->arg1, (size_t)record->arg2))
+          fprintf(stderr, "Failed to create event\n");
+        break;
+
+      case JOB_RESERVE:
+        if (ems_reserve(record->event_id, (size_t)record->num_coords, xs, ys))
+          fprintf(stderr, "Failed to reserve seats\n");
+        break;
+
+      case JOB_SHOW:
+        if (ems_show(out_fd, record->event_id)) fprintf(stderr, "Failed to show event\n");
+        break;
+
+      case JOB_DELETE:
+        if (ems_delete(record->event_id)) fprintf(stderr, "Failed to delete event\n");
+        break;
+
+      case JOB_LIST_EVENTS:
+        if (ems_list_events(out_fd)) fprintf(stderr, "Failed to list events\n");
+        break;
+
+      case JOB_WAIT:
+        ems_drain();
+        if (record->arg1 > 0) {
+          printf("Waiting...\n");
+          sleep((unsigned int)record->arg1);
+        }
+        break;
+
+      case JOB_HELP:
+        print_help();
+        break;
+
+      case JOB_BARRIER:  // Only the standalone EMS has barriers
+      case JOB_INVALID:
+        fprintf(stderr, "Invalid command. See HELP for usage\n");
+        break;
+    }
+  }
+
+  if (next == -1) fprintf(stderr, "Invalid compiled job file\n");
+  ems_drain();
+  jobfile_unmap(&job);
+  return next == -1;
+}
+
 int main(int argc, char* argv[]) {
   if (argc < 5) {
-    fprintf(stderr, "Usage: %s <request pipe path> <response pipe path> <server pipe path> <.jobs file path>\n",
+    fprintf(stderr,
+            "Usage: %s <request pipe path> <response pipe path> <server pipe path> <.jobs or .jobc file path>\n",
             argv[0]);
     return 1;
   }
 
+  // Talk to a server on the same machine through shared memory if requested
+  const char* shared_transport = getenv("EMS_SHARED_TRANSPORT");
+  ems_shared_transport(shared_transport != NULL && strcmp(shared_transport, "0") != 0);
+
   if (ems_setup(argv[1], argv[2], argv[3])) {
     fprintf(stderr, "Failed to set up EMS\n");
     unlink(argv[1]);
@@ -22,8 +105,13 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  // Commands are sent in batches, without waiting for the responses to the previous ones
+  ems_pipeline(PIPELINE_DEPTH);
+  ems_batching(1);
+
   const char* dot = strrchr(argv[4], '.');
-  if (dot == NULL || dot == argv[4] || strlen(dot) != 5 || strcmp(dot, ".jobs") ||
+  int compiled = dot != NULL && strcmp(dot, ".jobc") == 0;
+  if (dot == NULL || dot == argv[4] || strlen(dot) != 5 || (strcmp(dot, ".jobs") && !compiled) ||
       strlen(argv[4]) > MAX_JOB_FILE_NAME_SIZE) {
     fprintf(stderr, "The provided .jobs file path is not valid. Path: %s\n", argv[1]);
     return 1;
@@ -45,6 +133,14 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  if (compiled) {
+    int result = run_compiled(in_fd, out_fd);
+    close(in_fd);
+    close(out_fd);
+    ems_quit();
+    return result;
+  }
+
   while (1) {
     unsigned int event_id;
     size_t num_rows, num_columns, num_coords;
@@ -82,6 +178,15 @@ int main(int argc, char* argv[]) {
           fprintf(stderr, "Failed to show event\n");
         break;
 
+      case CMD_DELETE:
+        if (parse_delete(in_fd, &event_id) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        if (ems_delete(event_id)) fprintf(stderr, "Failed to delete event\n");
+        break;
+
       case CMD_LIST_EVENTS:
         if (ems_list_events(out_fd))
           fprintf(stderr, "Failed to list events\n");
@@ -93,6 +198,8 @@ int main(int argc, char* argv[]) {
             continue;
         }
 
+        // The commands before the wait are done before it starts
+        ems_drain();
         if (delay > 0) {
             printf("Waiting...\n");
             sleep(delay);
@@ -104,21 +211,15 @@ int main(int argc, char* argv[]) {
         break;
 
       case CMD_HELP:
-        printf(
-            "Available commands:\n"
-            "  CREATE <event_id> <num_rows> <num_columns>\n"
-            "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
-            "  SHOW <event_id>\n"
-            "  LIST\n"
-            "  WAIT <delay_ms>\n"
-            "  HELP\n");
-
+        print_help();
         break;
 
       case CMD_EMPTY:
         break;
 
       case EOC:
+        ems_drain();
+        free_read_buffer(in_fd);
         close(in_fd);
         close(out_fd);
         ems_quit();
@@ -7,6 +7,7 @@ enum Command {
   CMD_CREATE,
   CMD_RESERVE,
   CMD_SHOW,
+  CMD_DELETE,
   CMD_LIST_EVENTS,
   CMD_WAIT,
   CMD_HELP,
@@ -43,6 +44,12 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
 /// @return 0 if the command was parsed successfully, 1 otherwise.
 int parse_show(int fd, unsigned int *event_id);
 
+/// Parses a DELETE command.
+/// @param fd File descriptor to read from.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_delete(int fd, unsigned int *event_id);
+
 /// Parses a WAIT command.
 /// @param fd File descriptor to read from.
 /// @param delay Pointer to the variable to store the wait delay in.
@@ -1,5 +1,17 @@
 #define MAX_RESERVATION_SIZE 256
 #define STATE_ACCESS_DELAY_US 500000  // 500ms
 #define MAX_JOB_FILE_NAME_SIZE 256
-#define MAX_SESSION_COUNT 8
+#define WORKER_COUNT 8
 #define MAX_PIPE_PATH_SIZE 40
+#define EVENT_SHARD_COUNT 16
+#define SEAT_TILE_SIZE 4096
+#define MAX_OPTIMISTIC_SEATS 4
+#define READ_BUFFER_SIZE 65536
+#define MAX_BUFFERED_FDS 16384
+#define OUT_BUFFER_SIZE 65536
+#define OUT_SEAT_BATCH 256
+#define PIPELINE_DEPTH 8
+#define MAX_BATCH_COMMANDS 256
+#define SHARED_RING_SIZE 262144
+#define RING_SPIN_ITERATIONS 4096
+#define RING_SLEEP_NS 10000000  // 10ms
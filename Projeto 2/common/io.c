@@ -1,16 +1,100 @@
 #include "io.h"
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "common/constants.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define MAX_UINT_DIGITS 10
+
+// Bytes read ahead from a file descriptor
+struct ReadBuffer {
+  size_t pos;                   // Next byte to be returned
+  size_t len;                   // Number of bytes in data
+  char data[READ_BUFFER_SIZE];  // Bytes read from the file descriptor
+};
+
+static struct ReadBuffer *read_buffers[MAX_BUFFERED_FDS];  // Indexed by file descriptor, NULL until first read
+
+ssize_t buffered_read(int fd, void *buf, size_t len) {
+  // Descriptors without a buffer slot are read directly
+  if (fd < 0 || fd >= MAX_BUFFERED_FDS) {
+    return read(fd, buf, len);
+  }
+
+  struct ReadBuffer *buffer = read_buffers[fd];
+  if (buffer == NULL) {
+    buffer = malloc(sizeof(struct ReadBuffer));
+    if (buffer == NULL) {
+      return read(fd, buf, len);
+    }
+
+    buffer->pos = buffer->len = 0;
+    read_buffers[fd] = buffer;
+  }
+
+  char *ptr = buf;
+  size_t done = 0;
+  while (done < len) {
+    if (buffer->pos == buffer->len) {
+      ssize_t read_bytes = read(fd, buffer->data, READ_BUFFER_SIZE);
+      if (read_bytes == -1) {
+        return done > 0 ? (ssize_t)done : -1;
+      } else if (read_bytes == 0) {
+        break;
+      }
+
+      buffer->pos = 0;
+      buffer->len = (size_t)read_bytes;
+    }
+
+    size_t count = buffer->len - buffer->pos;
+    if (count > len - done) {
+      count = len - done;
+    }
+
+    memcpy(ptr + done, buffer->data + buffer->pos, count);
+    buffer->pos += count;
+    done += count;
+  }
+
+  return (ssize_t)done;
+}
+
+size_t buffered_bytes(int fd) {
+  if (fd < 0 || fd >= MAX_BUFFERED_FDS || read_buffers[fd] == NULL) {
+    return 0;
+  }
+
+  return read_buffers[fd]->len - read_buffers[fd]->pos;
+}
+
+void free_read_buffer(int fd) {
+  if (fd < 0 || fd >= MAX_BUFFERED_FDS) {
+    return;
+  }
+
+  free(read_buffers[fd]);
+  read_buffers[fd] = NULL;
+}
+
 int parse_uint(int fd, unsigned int *value, char *next) {
   char buf[16];
 
   int i = 0;
   while (1) {
-    ssize_t read_bytes = read(fd, buf + i, 1);
+    ssize_t read_bytes = buffered_read(fd, buf + i, 1);
     if (read_bytes == -1) {
       return 1;
     } else if (read_bytes == 0) {
@@ -39,40 +123,300 @@ int parse_uint(int fd, unsigned int *value, char *next) {
   return 0;
 }
 
-int print_uint(int fd, unsigned int value) {
-  char buffer[16];
-  size_t i = 16;
+int read_full(int fd, void *buf, size_t len) {
+  char *ptr = buf;
+  while (len > 0) {
+    ssize_t read_bytes = read(fd, ptr, len);
+    if (read_bytes <= 0) {
+      return 1;
+    }
 
-  for (; value > 0; value /= 10) {
-    buffer[--i] = '0' + (char)(value % 10);
+    ptr += (size_t)read_bytes;
+    len -= (size_t)read_bytes;
   }
 
-  if (i == 16) {
-    buffer[--i] = '0';
-  }
+  return 0;
+}
 
-  while (i < 16) {
-    ssize_t written = write(fd, buffer + i, 16 - i);
+int writev_full(int fd, struct iovec *iov, int count) {
+  while (count > 0) {
+    ssize_t written = writev(fd, iov, count);
     if (written == -1) {
       return 1;
     }
 
-    i += (size_t)written;
+    size_t left = (size_t)written;
+    for (; count > 0 && left >= iov->iov_len; iov++, count--) {
+      left -= iov->iov_len;
+    }
+
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + left;
+      iov->iov_len -= left;
+    }
   }
 
   return 0;
 }
 
-int print_str(int fd, const char *str) {
-  size_t len = strlen(str);
-  while (len > 0) {
-    ssize_t written = write(fd, str, len);
-    if (written == -1) {
-      return 1;
+// Digits of every number below 100, two characters each
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/// Formats an unsigned integer in decimal, two digits at a time.
+/// @param dst Buffer to write the digits to, with room for MAX_UINT_DIGITS characters.
+/// @param value The value to format.
+/// @return Number of characters written.
+static size_t format_uint(char *dst, unsigned int value) {
+  char buffer[MAX_UINT_DIGITS];
+  size_t i = sizeof(buffer);
+
+  for (; value >= 100; value /= 100) {
+    i -= 2;
+    memcpy(buffer + i, digit_pairs + (value % 100) * 2, 2);
+  }
+
+  if (value >= 10) {
+    i -= 2;
+    memcpy(buffer + i, digit_pairs + value * 2, 2);
+  } else {
+    buffer[--i] = (char)('0' + value);
+  }
+
+  memcpy(dst, buffer + i, sizeof(buffer) - i);
+  return sizeof(buffer) - i;
+}
+
+void out_init(struct OutBuffer *out, int fd) {
+  out->fd = fd;
+  out->used = 0;
+}
+
+int out_write(struct OutBuffer *out, const void *data, size_t len) {
+  if (len <= OUT_BUFFER_SIZE - out->used) {
+    memcpy(out->data + out->used, data, len);
+    out->used += len;
+    return 0;
+  }
+
+  // Written with what is already buffered, in a single call
+  struct iovec iov[2] = {{.iov_base = out->data, .iov_len = out->used}, {.iov_base = (void *)data, .iov_len = len}};
+  out->used = 0;
+  return writev_full(out->fd, iov, 2);
+}
+
+int out_str(struct OutBuffer *out, const char *str) { return out_write(out, str, strlen(str)); }
+
+int out_uint(struct OutBuffer *out, unsigned int value) {
+  char buffer[MAX_UINT_DIGITS];
+  return out_write(out, buffer, format_uint(buffer, value));
+}
+
+int out_flush(struct OutBuffer *out) {
+  struct iovec iov = {.iov_base = out->data, .iov_len = out->used};
+  out->used = 0;
+  return writev_full(out->fd, &iov, 1);
+}
+
+/// Formats seats followed by a space each, one at a time.
+/// @param dst Buffer to write to, with room for MAX_UINT_DIGITS + 1 characters per seat.
+/// @param seats The seats to format.
+/// @param count Number of seats.
+/// @return Number of characters written.
+static size_t format_seats_scalar(char *dst, const unsigned int *seats, size_t count) {
+  char *start = dst;
+  for (size_t i = 0; i < count; i++) {
+    dst += format_uint(dst, seats[i]);
+    *dst++ = ' ';
+  }
+
+  return (size_t)(dst - start);
+}
+
+static int seats_zero_scalar(const unsigned int *seats, size_t count) {
+  unsigned int any = 0;
+  for (size_t i = 0; i < count; i++) {
+    any |= seats[i];
+  }
+
+  return any == 0;
+}
+
+#if defined(__SSE2__)
+// Blocks of 4 seats below 10 are formatted at once, which covers rows of free seats and of the first reservations
+
+/// Formats seats followed by a space each, 4 at a time when they are all single digits.
+static size_t format_seats_sse2(char *dst, const unsigned int *seats, size_t count) {
+  const __m128i high = _mm_set1_epi32(~0xF), nine = _mm_set1_epi32(9), text = _mm_set1_epi32((' ' << 8) | '0');
+  char *start = dst;
+  size_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(seats + i));
+    __m128i narrow = _mm_andnot_si128(_mm_cmpgt_epi32(block, nine),
+                                      _mm_cmpeq_epi32(_mm_and_si128(block, high), _mm_setzero_si128()));
+    if (_mm_movemask_epi8(narrow) != 0xFFFF) {
+      dst += format_seats_scalar(dst, seats + i, 4);
+      continue;
+    }
+
+    // Each 32-bit lane becomes the digit followed by a space, then the lanes are narrowed to those 2 bytes
+    __m128i chars = _mm_add_epi32(block, text);
+    _mm_storel_epi64((__m128i *)dst, _mm_packs_epi32(chars, chars));
+    dst += 8;
+  }
+
+  dst += format_seats_scalar(dst, seats + i, count - i);
+  return (size_t)(dst - start);
+}
+
+static int seats_zero_sse2(const unsigned int *seats, size_t count) {
+  __m128i any = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    any = _mm_or_si128(any, _mm_loadu_si128((const __m128i *)(seats + i)));
+  }
+
+  return _mm_movemask_epi8(_mm_cmpeq_epi32(any, _mm_setzero_si128())) == 0xFFFF &&
+         seats_zero_scalar(seats + i, count - i);
+}
+#endif
+
+#if defined(__x86_64__)
+// Same as the SSE2 versions with blocks of 8 seats, used when the CPU supports AVX2
+
+__attribute__((target("avx2"))) static size_t format_seats_avx2(char *dst, const unsigned int *seats, size_t count) {
+  const __m256i high = _mm256_set1_epi32(~0xF), nine = _mm256_set1_epi32(9), text = _mm256_set1_epi32((' ' << 8) | '0');
+  char *start = dst;
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(seats + i));
+    __m256i narrow = _mm256_andnot_si256(_mm256_cmpgt_epi32(block, nine),
+                                         _mm256_cmpeq_epi32(_mm256_and_si256(block, high), _mm256_setzero_si256()));
+    if (_mm256_movemask_epi8(narrow) != -1) {
+      dst += format_seats_scalar(dst, seats + i, 8);
+      continue;
+    }
+
+    __m256i chars = _mm256_add_epi32(block, text);
+    _mm_storeu_si128((__m128i *)dst,
+                     _mm_packs_epi32(_mm256_castsi256_si128(chars), _mm256_extracti128_si256(chars, 1)));
+    dst += 16;
+  }
+
+  dst += format_seats_scalar(dst, seats + i, count - i);
+  return (size_t)(dst - start);
+}
+
+__attribute__((target("avx2"))) static int seats_zero_avx2(const unsigned int *seats, size_t count) {
+  __m256i any = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    any = _mm256_or_si256(any, _mm256_loadu_si256((const __m256i *)(seats + i)));
+  }
+
+  return _mm256_testz_si256(any, any) && seats_zero_scalar(seats + i, count - i);
+}
+#endif
+
+/// Formats seats followed by a space each, with the widest vector instructions the CPU supports.
+static size_t format_seats(char *dst, const unsigned int *seats, size_t count) {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2")) return format_seats_avx2(dst, seats, count);
+#endif
+#if defined(__SSE2__)
+  return format_seats_sse2(dst, seats, count);
+#else
+  return format_seats_scalar(dst, seats, count);
+#endif
+}
+
+/// Checks whether every seat is free, with the widest vector instructions the CPU supports.
+static int seats_zero(const unsigned int *seats, size_t count) {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2")) return seats_zero_avx2(seats, count);
+#endif
+#if defined(__SSE2__)
+  return seats_zero_sse2(seats, count);
+#else
+  return seats_zero_scalar(seats, count);
+#endif
+}
+
+/// Makes room for the given number of bytes at the end of an output buffer, writing it if needed.
+/// @return 0 if there is room, 1 if writing failed.
+static int out_reserve(struct OutBuffer *out, size_t len) {
+  return OUT_BUFFER_SIZE - out->used < len ? out_flush(out) : 0;
+}
+
+// "0 " for each of OUT_SEAT_BATCH free seats
+#define ZERO_SEATS_8 "0 0 0 0 0 0 0 0 "
+#define ZERO_SEATS_64 ZERO_SEATS_8 ZERO_SEATS_8 ZERO_SEATS_8 ZERO_SEATS_8 ZERO_SEATS_8 ZERO_SEATS_8 ZERO_SEATS_8 ZERO_SEATS_8
+static const char zero_seats[] = ZERO_SEATS_64 ZERO_SEATS_64 ZERO_SEATS_64 ZERO_SEATS_64;
+
+_Static_assert(sizeof(zero_seats) - 1 == 2 * OUT_SEAT_BATCH, "zero_seats must hold a batch of seats");
+_Static_assert(OUT_SEAT_BATCH * (MAX_UINT_DIGITS + 1) <= OUT_BUFFER_SIZE, "a batch of seats must fit in the buffer");
+
+int out_zero_seats(struct OutBuffer *out, size_t count, char last) {
+  if (count == 0) return 0;
+
+  for (size_t i = 0; i < count; i += OUT_SEAT_BATCH) {
+    size_t batch = count - i < OUT_SEAT_BATCH ? count - i : OUT_SEAT_BATCH;
+    if (out_reserve(out, 2 * batch)) return 1;
+
+    memcpy(out->data + out->used, zero_seats, 2 * batch);
+    out->used += 2 * batch;
+  }
+
+  // The buffer is only written before a batch, so the separator of the last seat is still in it
+  out->data[out->used - 1] = last;
+  return 0;
+}
+
+int out_seats(struct OutBuffer *out, const unsigned int *seats, size_t count, char last) {
+  if (count == 0) return 0;
+  if (seats_zero(seats, count)) return out_zero_seats(out, count, last);
+
+  for (size_t i = 0; i < count; i += OUT_SEAT_BATCH) {
+    size_t batch = count - i < OUT_SEAT_BATCH ? count - i : OUT_SEAT_BATCH;
+    if (out_reserve(out, batch * (MAX_UINT_DIGITS + 1))) return 1;
+
+    out->used += format_seats(out->data + out->used, seats + i, batch);
+  }
+
+  out->data[out->used - 1] = last;
+  return 0;
+}
+
+int out_seat_tile(struct OutBuffer *out, const unsigned char *seats, unsigned char width, size_t first, size_t count,
+                  size_t cols) {
+  unsigned int values[SEAT_TILE_SIZE];
+
+  if (width == 4) {
+    memcpy(values, seats, count * sizeof(unsigned int));
+  } else if (width == 2) {
+    for (size_t i = 0; i < count; i++) {
+      uint16_t value;
+      memcpy(&value, seats + i * 2, sizeof(uint16_t));
+      values[i] = value;
     }
+  } else if (width == 1) {
+    for (size_t i = 0; i < count; i++) {
+      values[i] = seats[i];
+    }
+  }
+
+  // Rows are formatted whole, a tile may start and end in the middle of one
+  for (size_t i = 0; i < count;) {
+    size_t row_left = cols - (first + i) % cols;
+    size_t run = row_left < count - i ? row_left : count - i;
+    char last = run == row_left ? '\n' : ' ';
 
-    str += (size_t)written;
-    len -= (size_t)written;
+    if (width == 0 ? out_zero_seats(out, run, last) : out_seats(out, values + i, run, last)) return 1;
+    i += run;
   }
 
   return 0;
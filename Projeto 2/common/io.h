@@ -1,6 +1,19 @@
 #ifndef COMMON_IO_H
 #define COMMON_IO_H
 
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "common/constants.h"
+
+// Output kept in memory until it fills up or is flushed, so that it is written with few system calls
+struct OutBuffer {
+  int fd;                      // File descriptor to write to
+  size_t used;                 // Number of bytes in data
+  char data[OUT_BUFFER_SIZE];  // Bytes not written yet
+};
+
 /// Parses an unsigned integer from the given file descriptor.
 /// @param fd The file descriptor to read from.
 /// @param value Pointer to the variable to store the value in.
@@ -8,16 +21,93 @@
 /// @return 0 if the integer was read successfully, 1 otherwise.
 int parse_uint(int fd, unsigned int *value, char *next);
 
-/// Prints an unsigned integer to the given file descriptor.
-/// @param fd The file descriptor to write to.
-/// @param value The value to write.
-/// @return 0 if the integer was written successfully, 1 otherwise.
-int print_uint(int fd, unsigned int value);
+/// Reads from the given file descriptor through a buffer, so that reading a few bytes at a time does not cost a system
+/// call each.
+/// @note Every read of the file descriptor must go through the buffer (buffered_read or parse_uint), and
+/// free_read_buffer must be called before closing it.
+/// @param fd The file descriptor to read from.
+/// @param buf Buffer to store the bytes in.
+/// @param len Number of bytes to read.
+/// @return Number of bytes read, less than len only at the end of the file, -1 on error.
+ssize_t buffered_read(int fd, void *buf, size_t len);
+
+/// Gets the number of bytes read ahead from a file descriptor and not returned by buffered_read yet.
+/// @param fd The file descriptor.
+/// @return Number of bytes left in the buffer of the file descriptor.
+size_t buffered_bytes(int fd);
+
+/// Frees the buffer of a file descriptor, discarding any bytes left in it.
+/// @param fd The file descriptor.
+void free_read_buffer(int fd);
+
+/// Reads exactly the given number of bytes, retrying on short reads.
+/// @param fd The file descriptor to read from.
+/// @param buf Buffer to store the bytes in.
+/// @param len Number of bytes to read.
+/// @return 0 if all the bytes were read, 1 on error or end of file.
+int read_full(int fd, void *buf, size_t len);
 
-/// Writes a string to the given file descriptor.
+/// Writes every byte of the given buffers, retrying on short writes.
 /// @param fd The file descriptor to write to.
-/// @param str The string to write.
-/// @return 0 if the string was written successfully, 1 otherwise.
-int print_str(int fd, const char *str);
+/// @param iov The buffers, consumed as they are written.
+/// @param count Number of buffers.
+/// @return 0 if all the bytes were written, 1 otherwise.
+int writev_full(int fd, struct iovec *iov, int count);
+
+/// Initializes an empty output buffer.
+/// @param out The output buffer.
+/// @param fd The file descriptor it writes to.
+void out_init(struct OutBuffer *out, int fd);
+
+/// Appends bytes to an output buffer, writing it together with them if they do not fit.
+/// @param out The output buffer.
+/// @param data The bytes to append.
+/// @param len Number of bytes to append.
+/// @return 0 if the bytes were appended successfully, 1 if writing failed.
+int out_write(struct OutBuffer *out, const void *data, size_t len);
+
+/// Appends a string to an output buffer.
+/// @param out The output buffer.
+/// @param str The string to append.
+/// @return 0 if the string was appended successfully, 1 if writing failed.
+int out_str(struct OutBuffer *out, const char *str);
+
+/// Appends an unsigned integer in decimal to an output buffer.
+/// @param out The output buffer.
+/// @param value The value to append.
+/// @return 0 if the integer was appended successfully, 1 if writing failed.
+int out_uint(struct OutBuffer *out, unsigned int value);
+
+/// Appends seats in decimal to an output buffer, separated by spaces.
+/// @note Rows of free seats and blocks of single digits are formatted with vector instructions when available.
+/// @param out The output buffer.
+/// @param seats The reservation of each seat, 0 if it is free.
+/// @param count Number of seats.
+/// @param last Character written after the last seat.
+/// @return 0 if the seats were appended successfully, 1 if writing failed.
+int out_seats(struct OutBuffer *out, const unsigned int *seats, size_t count, char last);
+
+/// Appends free seats to an output buffer, separated by spaces.
+/// @param out The output buffer.
+/// @param count Number of seats.
+/// @param last Character written after the last seat.
+/// @return 0 if the seats were appended successfully, 1 if writing failed.
+int out_zero_seats(struct OutBuffer *out, size_t count, char last);
+
+/// Appends a tile of seats, as sent by SHOW, to an output buffer with a newline at the end of each row.
+/// @param out The output buffer.
+/// @param seats The seats of the tile, width bytes each.
+/// @param width Bytes per seat, 0 if every seat of the tile is free.
+/// @param first Index of the first seat of the tile in the event.
+/// @param count Number of seats in the tile, at most SEAT_TILE_SIZE.
+/// @param cols Number of columns of the event.
+/// @return 0 if the seats were appended successfully, 1 if writing failed.
+int out_seat_tile(struct OutBuffer *out, const unsigned char *seats, unsigned char width, size_t first, size_t count,
+                  size_t cols);
+
+/// Writes everything in an output buffer to its file descriptor.
+/// @param out The output buffer.
+/// @return 0 if the buffer was written successfully, 1 otherwise.
+int out_flush(struct OutBuffer *out);
 
 #endif  // COMMON_IO_H
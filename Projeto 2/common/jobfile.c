@@ -0,0 +1,58 @@
+#include "common/jobfile.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common/constants.h"
+
+int jobfile_map(int fd, struct CompiledJob* job) {
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct JobHeader)) return 1;
+
+  void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) return 1;
+
+  const struct JobHeader* header = data;
+  if (memcmp(header->magic, JOBC_MAGIC, sizeof(header->magic)) != 0 || header->version != JOBC_VERSION) {
+    munmap(data, (size_t)st.st_size);
+    return 1;
+  }
+
+  // The commands are read once, front to back
+  posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+
+  job->data = data;
+  job->size = (size_t)st.st_size;
+  job->offset = sizeof(struct JobHeader);
+  return 0;
+}
+
+int jobfile_next(struct CompiledJob* job, const struct JobRecord** record, const size_t** xs, const size_t** ys) {
+  size_t left = job->size - job->offset;
+  if (left == 0) return 0;
+  if (left < sizeof(struct JobRecord)) return -1;
+
+  const struct JobRecord* next = (const void*)(job->data + job->offset);
+  if (next->op < JOB_CREATE || next->op > JOB_INVALID) return -1;
+
+  size_t length = sizeof(struct JobRecord);
+  if (next->op == JOB_RESERVE) {
+    if (next->num_coords == 0 || next->num_coords > MAX_RESERVATION_SIZE) return -1;
+
+    length += 2 * next->num_coords * sizeof(size_t);
+    if (left < length) return -1;
+
+    *xs = (const void*)(next + 1);
+    *ys = *xs + next->num_coords;
+  }
+
+  job->offset += length;
+  *record = next;
+  return 1;
+}
+
+void jobfile_unmap(struct CompiledJob* job) {
+  munmap((void*)job->data, job->size);
+  job->data = NULL;
+}
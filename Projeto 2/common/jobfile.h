@@ -0,0 +1,67 @@
+#ifndef COMMON_JOBFILE_H
+#define COMMON_JOBFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A compiled job file (.jobc) is a header followed by one record per command. A RESERVE record is followed by the
+// rows and then the columns of its seats, so that they are used in place as xs and ys. Every field is in the byte
+// order of the machine that compiled the file, and every record starts 8-byte aligned.
+
+#define JOBC_MAGIC "EMSJ"
+#define JOBC_VERSION 1
+
+// Operation of a record, shared with the compiled job files of the standalone EMS
+enum JobOp {
+  JOB_CREATE = 1,
+  JOB_RESERVE,
+  JOB_SHOW,
+  JOB_LIST_EVENTS,
+  JOB_WAIT,
+  JOB_BARRIER,
+  JOB_HELP,
+  JOB_DELETE,
+  JOB_INVALID
+};
+
+struct JobHeader {
+  char magic[4];     // JOBC_MAGIC, without the terminator
+  uint32_t version;  // JOBC_VERSION
+};
+
+struct JobRecord {
+  uint32_t op;          // enum JobOp
+  uint32_t event_id;    // Event of CREATE, RESERVE, SHOW and DELETE
+  uint64_t arg1;        // Rows of CREATE, delay of WAIT
+  uint64_t arg2;        // Columns of CREATE
+  uint64_t num_coords;  // Seats of RESERVE, followed by num_coords rows and num_coords columns
+};
+
+_Static_assert(sizeof(size_t) == sizeof(uint64_t), "the coordinates of a record are used in place as size_t");
+
+// Compiled job file mapped in memory
+struct CompiledJob {
+  const char* data;
+  size_t size;
+  size_t offset;  // Offset of the next record
+};
+
+/// Maps a compiled job file in memory.
+/// @param fd File descriptor of the compiled job file.
+/// @param job Compiled job to initialize.
+/// @return 0 if the file was mapped successfully, 1 if it could not be mapped or is not a compiled job file.
+int jobfile_map(int fd, struct CompiledJob* job);
+
+/// Reads the next record of a compiled job file, without copying it.
+/// @param job Compiled job to read from.
+/// @param record Pointer to store the record in.
+/// @param xs Pointer to store the rows of the seats of a RESERVE in.
+/// @param ys Pointer to store the columns of the seats of a RESERVE in.
+/// @return 1 if a record was read, 0 at the end of the file, -1 if the record is corrupted.
+int jobfile_next(struct CompiledJob* job, const struct JobRecord** record, const size_t** xs, const size_t** ys);
+
+/// Unmaps a compiled job file.
+/// @param job Compiled job to unmap.
+void jobfile_unmap(struct CompiledJob* job);
+
+#endif  // COMMON_JOBFILE_H
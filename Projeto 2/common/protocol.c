@@ -0,0 +1,110 @@
+#include "protocol.h"
+
+#include <string.h>
+
+#include "common/io.h"
+
+// Ring used instead of each pipe, NULL for pipes that carry the messages themselves
+static struct Ring *fd_rings[MAX_BUFFERED_FDS];
+
+int attach_ring(int fd, struct Ring *ring) {
+  if (fd < 0 || fd >= MAX_BUFFERED_FDS) {
+    return 1;
+  }
+
+  fd_rings[fd] = ring;
+  return 0;
+}
+
+void detach_ring(int fd) {
+  if (fd >= 0 && fd < MAX_BUFFERED_FDS) {
+    fd_rings[fd] = NULL;
+  }
+}
+
+struct Ring *fd_ring(int fd) { return fd >= 0 && fd < MAX_BUFFERED_FDS ? fd_rings[fd] : NULL; }
+
+int send_frame(int fd, uint8_t op, uint32_t request_id, int32_t session_id, const struct iovec *payload, int count) {
+  struct FrameHeader header = {.request_id = request_id, .session_id = session_id, .op = op};
+  struct iovec iov[MAX_FRAME_PARTS + 1];
+  size_t length = 0;
+
+  if (count > MAX_FRAME_PARTS) {
+    return 1;
+  }
+
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+  for (int i = 0; i < count; i++) {
+    iov[i + 1] = payload[i];
+    length += payload[i].iov_len;
+  }
+
+  if (length > UINT32_MAX) {
+    return 1;
+  }
+
+  header.length = (uint32_t)length;
+
+  struct Ring *ring = fd_ring(fd);
+  if (ring != NULL) {
+    return ring_write(ring, iov, count + 1, fd);
+  }
+
+  return writev_full(fd, iov, count + 1);
+}
+
+int send_status(int fd, const struct FrameHeader *request, int status) {
+  struct iovec payload = {.iov_base = &status, .iov_len = sizeof(int)};
+  return send_frame(fd, request->op, request->request_id, request->session_id, &payload, 1);
+}
+
+int recv_header(int fd, struct FrameHeader *header) { return recv_payload(fd, header, sizeof(*header)); }
+
+int recv_payload(int fd, void *buf, size_t len) {
+  struct Ring *ring = fd_ring(fd);
+  if (ring != NULL) {
+    return ring_read(ring, buf, len, fd);
+  }
+
+  ssize_t read_bytes = buffered_read(fd, buf, len);
+  return read_bytes < 0 || (size_t)read_bytes != len;
+}
+
+int recv_frame(int fd, struct FrameHeader *header, void *payload, size_t max) {
+  if (recv_header(fd, header) != 0) {
+    return 1;
+  }
+
+  if (header->length <= max) {
+    return recv_payload(fd, payload, header->length);
+  }
+
+  // The payload is read anyway, so that the next frame of a pipe shared by many writers starts at its header
+  unsigned char discarded[256];
+  for (size_t left = header->length; left > 0;) {
+    size_t count = left < sizeof(discarded) ? left : sizeof(discarded);
+    if (recv_payload(fd, discarded, count) != 0) {
+      break;
+    }
+    left -= count;
+  }
+
+  return 1;
+}
+
+void payload_init(struct PayloadReader *reader, const void *payload, size_t length) {
+  reader->data = payload;
+  reader->left = length;
+}
+
+int payload_take(struct PayloadReader *reader, void *field, size_t size) {
+  if (size > reader->left) {
+    return 1;
+  }
+
+  memcpy(field, reader->data, size);
+  reader->data += size;
+  reader->left -= size;
+  return 0;
+}
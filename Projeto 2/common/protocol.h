@@ -0,0 +1,132 @@
+#ifndef COMMON_PROTOCOL_H
+#define COMMON_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "common/constants.h"
+#include "common/ring.h"
+
+// Every message between a client and the server is a FrameHeader followed by length bytes of payload, written with a
+// single system call. Fields are in the byte order of the machine, like the rest of the protocol.
+//
+// Payload of each request and of its response (which has the op and request_id of the request):
+//   OP_SETUP        request: (char[MAX_PIPE_PATH_SIZE]) req_pipe_path | (char[MAX_PIPE_PATH_SIZE]) resp_pipe_path,
+//                            optionally followed by (char[MAX_PIPE_PATH_SIZE]) name of the shared memory of the session
+//                   response: (int) shared, 1 if the rest of the session goes through the shared memory; the session
+//                             is in the header
+//   OP_QUIT         request: empty, there is no response
+//   OP_CREATE       request: (unsigned int) event_id | (size_t) num_rows | (size_t) num_cols
+//                   response: (int) status
+//   OP_RESERVE      request: (unsigned int) event_id | (size_t) num_seats | (size_t[num_seats]) xs |
+//                            (size_t[num_seats]) ys
+//                   response: (int) status
+//   OP_DELETE       request: (unsigned int) event_id
+//                   response: (int) status
+//   OP_SHOW         request: (unsigned int) event_id
+//                   response: (int) status, followed when it is 0 by (size_t) num_rows | (size_t) num_cols |
+//                             (unsigned char[tiles]) width of each tile | seats of the tiles with reservations
+//   OP_LIST_EVENTS  request: empty
+//                   response: (int) status, followed when it is 0 by (size_t) num_events |
+//                             (unsigned int[num_events]) event ids
+//   OP_BATCH        request: (size_t) num_commands | num_commands times (uint8_t) op | request payload of op, where op
+//                            is OP_CREATE, OP_RESERVE, OP_SHOW or OP_LIST_EVENTS
+//                   response: (int) status, followed when it is 0 by (size_t) num_results | num_results times
+//                             (uint8_t) op | response payload of op, in the order of the commands
+//
+// A session over shared memory sends the same messages through a pair of rings (see common/ring.h) instead of the
+// pipes, which then only carry a byte to wake up an idle reader and tell each side when the other one is gone.
+
+enum Op { OP_SETUP = 1, OP_QUIT, OP_CREATE, OP_RESERVE, OP_SHOW, OP_LIST_EVENTS, OP_DELETE, OP_BATCH };
+
+struct FrameHeader {
+  uint32_t length;      // Bytes of payload after the header
+  uint32_t request_id;  // Chosen by the client, repeated in the response
+  int32_t session_id;   // Session of the client, set by the server in the response to OP_SETUP
+  uint8_t op;           // enum Op
+  uint8_t reserved[3];  // Always 0
+};
+
+// Largest payload of a request, a RESERVE of MAX_RESERVATION_SIZE seats (batches are limited to the same size)
+#define MAX_REQUEST_PAYLOAD (sizeof(unsigned int) + sizeof(size_t) + 2 * MAX_RESERVATION_SIZE * sizeof(size_t))
+
+// Largest number of parts in the payload of a message
+#define MAX_FRAME_PARTS 7
+
+// Fields read in order from a payload received whole
+struct PayloadReader {
+  const unsigned char *data;
+  size_t left;  // Bytes not read yet
+};
+
+/// Makes the messages sent to or received from a pipe go through a ring of shared memory instead.
+/// @param fd The pipe.
+/// @param ring The ring.
+/// @return 0 if the ring was attached, 1 if the file descriptor is too large.
+int attach_ring(int fd, struct Ring *ring);
+
+/// Makes the messages of a pipe go through the pipe again.
+/// @param fd The pipe.
+void detach_ring(int fd);
+
+/// Gets the ring attached to a pipe.
+/// @param fd The pipe.
+/// @return The ring, NULL if the messages go through the pipe.
+struct Ring *fd_ring(int fd);
+
+/// Sends a message in a single system call, retrying on short writes.
+/// @note Messages to a pipe with a ring attached are copied to the ring, without a system call if the reader is busy.
+/// @param fd The file descriptor to write to.
+/// @param op The operation of the message.
+/// @param request_id The id of the request, or of the request being answered.
+/// @param session_id The session of the client.
+/// @param payload The parts of the payload, written one after the other.
+/// @param count Number of parts, at most MAX_FRAME_PARTS.
+/// @return 0 if the message was sent successfully, 1 otherwise.
+int send_frame(int fd, uint8_t op, uint32_t request_id, int32_t session_id, const struct iovec *payload, int count);
+
+/// Sends a response that only has a status.
+/// @param fd The file descriptor to write to.
+/// @param request The header of the request being answered.
+/// @param status 0 if the request succeeded, 1 otherwise.
+/// @return 0 if the response was sent successfully, 1 otherwise.
+int send_status(int fd, const struct FrameHeader *request, int status);
+
+/// Receives the header of a message.
+/// @note Reads go through buffered_read, so a whole message usually takes a single system call.
+/// @param fd The file descriptor to read from.
+/// @param header Pointer to store the header in.
+/// @return 0 if a header was received, 1 on error or end of file.
+int recv_header(int fd, struct FrameHeader *header);
+
+/// Receives part of the payload of a message, after its header.
+/// @param fd The file descriptor to read from.
+/// @param buf Buffer to store the bytes in.
+/// @param len Number of bytes to receive.
+/// @return 0 if all the bytes were received, 1 on error or end of file.
+int recv_payload(int fd, void *buf, size_t len);
+
+/// Receives a whole message.
+/// @param fd The file descriptor to read from.
+/// @param header Pointer to store the header in.
+/// @param payload Buffer to store the payload in.
+/// @param max Size of the buffer, larger payloads are an error.
+/// @note A payload that is too large is read and dropped, so the next message can still be received.
+/// @return 0 if the message was received, 1 on error, end of file or if the payload is too large.
+int recv_frame(int fd, struct FrameHeader *header, void *payload, size_t max);
+
+/// Starts reading the fields of a payload.
+/// @param reader The reader to initialize.
+/// @param payload The payload.
+/// @param length Size of the payload.
+void payload_init(struct PayloadReader *reader, const void *payload, size_t length);
+
+/// Reads the next field of a payload.
+/// @param reader The reader.
+/// @param field Pointer to store the field in.
+/// @param size Size of the field.
+/// @return 0 if the field was read, 1 if the payload is too short.
+int payload_take(struct PayloadReader *reader, void *field, size_t size);
+
+#endif  // COMMON_PROTOCOL_H
@@ -0,0 +1,216 @@
+// syscall is not part of POSIX
+#define _DEFAULT_SOURCE
+
+#include "ring.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+_Static_assert((SHARED_RING_SIZE & (SHARED_RING_SIZE - 1)) == 0, "the positions of a ring wrap around at 2^32");
+
+/// Lets the other hyperthread of the core run while spinning.
+static inline void cpu_relax(void) {
+#if defined(__x86_64__)
+  _mm_pause();
+#endif
+}
+
+/// Number of times a ring is checked before sleeping, spinning only helps when the other side runs on another CPU.
+/// @return The number of times.
+static int spin_iterations(void) {
+  static atomic_int iterations = -1;
+
+  int value = atomic_load_explicit(&iterations, memory_order_relaxed);
+  if (value == -1) {
+    value = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPIN_ITERATIONS : 0;
+    atomic_store_explicit(&iterations, value, memory_order_relaxed);
+  }
+
+  return value;
+}
+
+/// Checks whether the process at the other end of the pipe of a session is gone.
+/// @param fd Pipe of the session.
+/// @return 1 if the other end of the pipe was closed, 0 otherwise.
+static int peer_gone(int fd) {
+  struct pollfd pfd = {.fd = fd, .events = 0};
+  return poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLHUP | POLLERR)) != 0;
+}
+
+/// Waits for the other side of a ring to move its position.
+/// @note Sleeps are bounded by RING_SLEEP_NS, so that a dead process is noticed.
+/// @param position The position.
+/// @param seen Value of the position last seen.
+/// @param sleeping Flag telling the other side to wake this one up.
+/// @param fd Pipe of the session.
+/// @return 0 if the position moved or may have, 1 if the other side is gone.
+static int wait_moved(atomic_uint* position, unsigned int seen, atomic_uint* sleeping, int fd) {
+  for (int i = spin_iterations(); i > 0; i--) {
+    if (atomic_load_explicit(position, memory_order_acquire) != seen) return 0;
+    cpu_relax();
+  }
+
+  // Either the other side sees the flag after moving the position, or the position is seen moved here
+  atomic_store(sleeping, 1);
+  if (atomic_load(position) == seen) {
+    struct timespec timeout = {0, RING_SLEEP_NS};
+    syscall(SYS_futex, position, FUTEX_WAIT, seen, &timeout, NULL, 0);
+  }
+  atomic_store(sleeping, 0);
+
+  return atomic_load(position) == seen && peer_gone(fd);
+}
+
+/// Moves a position of a ring, waking up the other side if it sleeps on it.
+/// @param position The position.
+/// @param value The new value of the position.
+/// @param sleeping Flag set by the other side while sleeping on the position.
+static void publish(atomic_uint* position, unsigned int value, atomic_uint* sleeping) {
+  atomic_store(position, value);
+  if (atomic_load(sleeping)) {
+    syscall(SYS_futex, position, FUTEX_WAKE, 1, NULL, NULL, 0);
+  }
+}
+
+/// Makes the bytes written to a ring visible to the consumer, ringing the doorbell if it is idle.
+/// @param ring The ring.
+/// @param tail The new tail of the ring.
+/// @param fd Pipe of the session.
+/// @return 0 if the consumer was woken up, 1 if the doorbell could not be rung.
+static int publish_tail(struct Ring* ring, unsigned int tail, int fd) {
+  publish(&ring->tail, tail, &ring->reader_sleeping);
+
+  // An idle consumer waits for its pipe, not for the futex
+  if (atomic_load(&ring->consumer_idle) && atomic_exchange(&ring->consumer_idle, 0)) {
+    return write(fd, "", 1) != 1;
+  }
+
+  return 0;
+}
+
+struct SharedRings* shared_rings_create(const char* name) {
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1) return NULL;
+
+  if (ftruncate(fd, sizeof(struct SharedRings)) == -1) {
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+
+  struct SharedRings* rings = mmap(NULL, sizeof(struct SharedRings), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (rings == MAP_FAILED) {
+    shm_unlink(name);
+    return NULL;
+  }
+
+  // The object starts zeroed, with the server idle until the first request
+  atomic_store(&rings->requests.consumer_idle, 1);
+  return rings;
+}
+
+struct SharedRings* shared_rings_open(const char* name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1) return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size != sizeof(struct SharedRings)) {
+    close(fd);
+    return NULL;
+  }
+
+  struct SharedRings* rings = mmap(NULL, sizeof(struct SharedRings), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return rings == MAP_FAILED ? NULL : rings;
+}
+
+void shared_rings_close(struct SharedRings* rings) { munmap(rings, sizeof(struct SharedRings)); }
+
+int ring_write(struct Ring* ring, const struct iovec* iov, int count, int fd) {
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+  for (int i = 0; i < count; i++) {
+    const unsigned char* src = iov[i].iov_base;
+    size_t left = iov[i].iov_len;
+
+    while (left > 0) {
+      unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+      size_t room = SHARED_RING_SIZE - (tail - head);
+      if (room == 0) {
+        // What was written so far is published, so that the consumer makes room
+        if (publish_tail(ring, tail, fd) || wait_moved(&ring->head, head, &ring->writer_sleeping, fd)) return 1;
+        continue;
+      }
+
+      size_t offset = tail % SHARED_RING_SIZE;
+      size_t count_bytes = left < room ? left : room;
+      if (count_bytes > SHARED_RING_SIZE - offset) count_bytes = SHARED_RING_SIZE - offset;
+
+      memcpy(ring->data + offset, src, count_bytes);
+      src += count_bytes;
+      left -= count_bytes;
+      tail += (unsigned int)count_bytes;
+    }
+  }
+
+  return publish_tail(ring, tail, fd);
+}
+
+int ring_read(struct Ring* ring, void* buf, size_t len, int fd) {
+  unsigned char* dst = buf;
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+  while (len > 0) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t available = tail - head;
+    if (available == 0) {
+      // What was read so far is given back, so that the producer can write the rest
+      publish(&ring->head, head, &ring->writer_sleeping);
+      if (wait_moved(&ring->tail, tail, &ring->reader_sleeping, fd)) return 1;
+      continue;
+    }
+
+    size_t offset = head % SHARED_RING_SIZE;
+    size_t count = len < available ? len : available;
+    if (count > SHARED_RING_SIZE - offset) count = SHARED_RING_SIZE - offset;
+
+    memcpy(dst, ring->data + offset, count);
+    dst += count;
+    len -= count;
+    head += (unsigned int)count;
+  }
+
+  publish(&ring->head, head, &ring->writer_sleeping);
+  return 0;
+}
+
+size_t ring_available(struct Ring* ring) {
+  return atomic_load_explicit(&ring->tail, memory_order_acquire) -
+         atomic_load_explicit(&ring->head, memory_order_relaxed);
+}
+
+int ring_idle(struct Ring* ring) {
+  for (int i = spin_iterations(); i > 0; i--) {
+    if (ring_available(ring) > 0) return 0;
+    cpu_relax();
+  }
+
+  // Bytes written before the producer could see the flag ring no doorbell, so they are read now, unless the producer
+  // already took the flag back to ring it
+  atomic_store(&ring->consumer_idle, 1);
+  if (atomic_load(&ring->tail) == atomic_load(&ring->head)) return 1;
+
+  return atomic_exchange(&ring->consumer_idle, 0) == 0;
+}
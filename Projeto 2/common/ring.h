@@ -0,0 +1,69 @@
+#ifndef COMMON_RING_H
+#define COMMON_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "common/constants.h"
+
+// Bytes sent by one process to another through shared memory, one producer and one consumer. The positions only grow
+// (wrapping around at 2^32) and index the data modulo SHARED_RING_SIZE. A side that has to wait spins for a while and
+// then sleeps on a futex, woken up by the other side when it moves its position.
+struct Ring {
+  _Alignas(64) atomic_uint tail;  // Bytes written, moved by the producer
+  atomic_uint reader_sleeping;    // The consumer sleeps on tail
+  atomic_uint consumer_idle;      // The consumer waits for a doorbell byte in the pipe of the session instead
+  _Alignas(64) atomic_uint head;  // Bytes read, moved by the consumer
+  atomic_uint writer_sleeping;    // The producer sleeps on head
+  _Alignas(64) unsigned char data[SHARED_RING_SIZE];
+};
+
+// Shared memory of a session, created by the client and mapped by the server
+struct SharedRings {
+  struct Ring requests;   // Written by the client
+  struct Ring responses;  // Written by the server
+};
+
+/// Creates and maps the shared memory of a session.
+/// @param name Name of the shared memory object, starting with '/'.
+/// @return The shared memory, NULL on failure.
+struct SharedRings* shared_rings_create(const char* name);
+
+/// Maps the shared memory of a session created by the client.
+/// @param name Name of the shared memory object.
+/// @return The shared memory, NULL on failure.
+struct SharedRings* shared_rings_open(const char* name);
+
+/// Unmaps the shared memory of a session.
+/// @param rings The shared memory.
+void shared_rings_close(struct SharedRings* rings);
+
+/// Writes bytes to a ring, waiting for room while the consumer reads, and rings the doorbell if the consumer is idle.
+/// @param ring The ring.
+/// @param iov The parts to write, one after the other.
+/// @param count Number of parts.
+/// @param fd Pipe of the session, where the doorbell byte is written and whose other end closes if the consumer dies.
+/// @return 0 if the bytes were written, 1 if the consumer is gone.
+int ring_write(struct Ring* ring, const struct iovec* iov, int count, int fd);
+
+/// Reads bytes from a ring, waiting for them if needed.
+/// @param ring The ring.
+/// @param buf Buffer to store the bytes in.
+/// @param len Number of bytes to read.
+/// @param fd Pipe of the session, whose other end closes if the producer dies.
+/// @return 0 if the bytes were read, 1 if the producer is gone.
+int ring_read(struct Ring* ring, void* buf, size_t len, int fd);
+
+/// Gets the number of bytes written to a ring and not read yet.
+/// @param ring The ring.
+/// @return Number of bytes that can be read without waiting.
+size_t ring_available(struct Ring* ring);
+
+/// Marks the consumer of a ring idle, so that the producer rings the doorbell with its next bytes.
+/// @note Spins for a while first, bytes written by a busy producer are read without a doorbell.
+/// @param ring The ring.
+/// @return 1 if the consumer is idle, 0 if there are bytes to read.
+int ring_idle(struct Ring* ring);
+
+#endif  // COMMON_RING_H
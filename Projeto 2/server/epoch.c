@@ -0,0 +1,151 @@
+#include "epoch.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define EPOCH_MAX_THREADS 64
+
+// Epoch announced by a thread, 0 when it is not in a critical section
+struct EpochRecord {
+  atomic_int used;
+  atomic_ulong epoch;
+};
+
+// Memory waiting for every thread to leave the epoch it was retired in
+struct Retired {
+  void* ptr;
+  void (*free_fn)(void*);
+  unsigned long epoch;
+  struct Retired* next;
+};
+
+static atomic_ulong global_epoch = 1;
+static struct EpochRecord records[EPOCH_MAX_THREADS];
+static _Thread_local struct EpochRecord* thread_record = NULL;
+
+// Released by the destructor of the key when the thread that claimed it exits
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t record_key;
+
+static pthread_mutex_t retired_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct Retired* retired = NULL;
+static atomic_size_t retired_count = 0;  // Read without the mutex, so that epoch_exit rarely takes it
+
+/// Releases the record of a thread that exited, so that another thread can claim it.
+/// @param record The record.
+static void release_record(void* record) {
+  atomic_store(&((struct EpochRecord*)record)->epoch, 0);
+  atomic_store(&((struct EpochRecord*)record)->used, 0);
+}
+
+static void create_record_key(void) { pthread_key_create(&record_key, release_record); }
+
+/// Gets the record of the calling thread, claiming a free one on the first call.
+/// @return Record of the thread, NULL if all the records are in use.
+static struct EpochRecord* get_record(void) {
+  if (thread_record != NULL) return thread_record;
+
+  pthread_once(&record_key_once, create_record_key);
+
+  for (size_t i = 0; i < EPOCH_MAX_THREADS; i++) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&records[i].used, &expected, 1)) {
+      if (pthread_setspecific(record_key, &records[i]) != 0) {
+        atomic_store(&records[i].used, 0);
+        return NULL;
+      }
+
+      thread_record = &records[i];
+      return thread_record;
+    }
+  }
+
+  return NULL;
+}
+
+int epoch_enter(void) {
+  struct EpochRecord* record = get_record();
+  if (record == NULL) return 1;
+
+  // seq_cst, so that a thread retiring memory either sees this thread as active or was done before it entered
+  atomic_store(&record->epoch, atomic_load(&global_epoch));
+  return 0;
+}
+
+/// Advances the global epoch if every thread in a critical section has already seen the current one.
+/// @return The global epoch.
+static unsigned long try_advance(void) {
+  unsigned long epoch = atomic_load(&global_epoch);
+
+  for (size_t i = 0; i < EPOCH_MAX_THREADS; i++) {
+    unsigned long announced = atomic_load(&records[i].epoch);
+    if (announced != 0 && announced != epoch) return epoch;
+  }
+
+  atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1);
+  return atomic_load(&global_epoch);
+}
+
+/// Frees the retired memory that no thread can still be holding a reference to.
+/// @note The caller must hold retired_mutex.
+static void reclaim(void) {
+  // Threads that may hold a reference announced at most the epoch of the memory, two advances guarantee they all left.
+  // Each advance checks the announced epochs again, so trying both now frees memory retired while nobody was reading.
+  try_advance();
+  unsigned long epoch = try_advance();
+
+  struct Retired** current = &retired;
+  while (*current != NULL) {
+    struct Retired* temp = *current;
+    if (temp->epoch + 2 <= epoch) {
+      *current = temp->next;
+      temp->free_fn(temp->ptr);
+      free(temp);
+      atomic_fetch_sub(&retired_count, 1);
+    } else {
+      current = &temp->next;
+    }
+  }
+}
+
+void epoch_exit(void) {
+  if (thread_record == NULL) return;
+  atomic_store(&thread_record->epoch, 0);
+
+  // Memory retired while this thread was reading may be freed now, instead of waiting for the next retire
+  if (atomic_load_explicit(&retired_count, memory_order_relaxed) > 0 && pthread_mutex_trylock(&retired_mutex) == 0) {
+    reclaim();
+    pthread_mutex_unlock(&retired_mutex);
+  }
+}
+
+int epoch_retire(void* ptr, void (*free_fn)(void*)) {
+  struct Retired* node = malloc(sizeof(struct Retired));
+  if (node == NULL) return 1;
+
+  node->ptr = ptr;
+  node->free_fn = free_fn;
+  node->epoch = atomic_load(&global_epoch);
+
+  pthread_mutex_lock(&retired_mutex);
+  node->next = retired;
+  retired = node;
+  atomic_fetch_add(&retired_count, 1);
+
+  reclaim();
+  pthread_mutex_unlock(&retired_mutex);
+  return 0;
+}
+
+void epoch_terminate(void) {
+  pthread_mutex_lock(&retired_mutex);
+  while (retired != NULL) {
+    struct Retired* temp = retired;
+    retired = temp->next;
+    temp->free_fn(temp->ptr);
+    free(temp);
+  }
+  atomic_store(&retired_count, 0);
+  pthread_mutex_unlock(&retired_mutex);
+}
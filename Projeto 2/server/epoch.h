@@ -0,0 +1,25 @@
+#ifndef SERVER_EPOCH_H
+#define SERVER_EPOCH_H
+
+/// Enters a read-side critical section.
+/// @note Memory retired after this call is not freed until the thread calls epoch_exit.
+/// @note The first call claims a record for the thread, released when the thread exits.
+/// @return 0 if the critical section was entered, 1 if there were too many threads.
+int epoch_enter(void);
+
+/// Leaves the read-side critical section of the calling thread.
+/// @note Also frees the retired memory that no thread can be using anymore.
+void epoch_exit(void);
+
+/// Frees memory once no thread can still be holding a reference to it.
+/// @note The memory must already be unreachable for threads that enter a critical section after this call.
+/// @param ptr Memory to be freed.
+/// @param free_fn Function used to free the memory.
+/// @return 0 if the memory was retired successfully, 1 otherwise (nothing is freed).
+int epoch_retire(void* ptr, void (*free_fn)(void*));
+
+/// Frees all the retired memory.
+/// @note No thread may be in a critical section.
+void epoch_terminate(void);
+
+#endif  // SERVER_EPOCH_H
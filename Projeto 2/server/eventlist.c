@@ -1,7 +1,120 @@
 #include "eventlist.h"
 
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "common/constants.h"
+
+#define INDEX_INITIAL_CAPACITY 16
+#define INDEX_MIGRATE_STEP 4  // Slots of the old index migrated per insertion while resizing
+#define NODE_SLAB_SIZE 64
+
+/// Rounds a size up to a multiple of the cache line size.
+static size_t cache_line_round(size_t size) { return (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE; }
+
+/// Gets the home slot of an event id (Fibonacci hashing).
+/// @param capacity Capacity of the index, a power of two.
+/// @param event_id Event id.
+/// @return Index of the first slot to probe.
+static size_t index_slot(size_t capacity, unsigned int event_id) {
+  return (size_t)(((uint64_t)event_id * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+static struct ListNode* index_find(struct EventIndex* index, unsigned int event_id) {
+  if (index->capacity == 0) return NULL;
+
+  for (size_t i = index_slot(index->capacity, event_id);; i = (i + 1) & (index->capacity - 1)) {
+    struct ListNode* node = index->slots[i];
+    if (node == NULL) return NULL;
+    if (node->event->id == event_id) return node;
+  }
+}
+
+/// Removes a node from the index, shifting back the nodes that follow it so that no probe sequence is broken.
+/// @return 0 if the node was removed, 1 if it was not in the index.
+static int index_remove(struct EventIndex* index, unsigned int event_id) {
+  if (index->capacity == 0) return 1;
+
+  size_t mask = index->capacity - 1;
+  size_t hole = index_slot(index->capacity, event_id);
+  for (; index->slots[hole] == NULL || index->slots[hole]->event->id != event_id; hole = (hole + 1) & mask) {
+    if (index->slots[hole] == NULL) return 1;
+  }
+
+  index->slots[hole] = NULL;
+  index->count--;
+
+  for (size_t i = (hole + 1) & mask; index->slots[i] != NULL; i = (i + 1) & mask) {
+    size_t home = index_slot(index->capacity, index->slots[i]->event->id);
+
+    // Move the node into the hole unless its home slot lies cyclically in (hole, i]
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      index->slots[hole] = index->slots[i];
+      index->slots[i] = NULL;
+      hole = i;
+    }
+  }
+
+  return 0;
+}
+
+/// Inserts a node in the index.
+/// @note The index must have at least one free slot.
+static void index_insert(struct EventIndex* index, struct ListNode* node) {
+  size_t i = index_slot(index->capacity, node->event->id);
+  while (index->slots[i] != NULL) {
+    i = (i + 1) & (index->capacity - 1);
+  }
+
+  index->slots[i] = node;
+  index->count++;
+}
+
+/// Moves some nodes from the old index to the current one, so that the cost of a resize is spread over the insertions
+/// that follow it instead of stopping the world to rehash everything at once.
+/// @note Migrated nodes are left in the old index, lookups check the current index first.
+static void index_migrate(struct EventList* list, size_t steps) {
+  struct EventIndex* old = &list->old_index;
+  if (old->slots == NULL) return;
+
+  for (; steps > 0 && list->migrate_pos < old->capacity; steps--, list->migrate_pos++) {
+    struct ListNode* node = old->slots[list->migrate_pos];
+    if (node != NULL && index_find(&list->index, node->event->id) == NULL) {
+      index_insert(&list->index, node);
+    }
+  }
+
+  if (list->migrate_pos == old->capacity) {
+    free(old->slots);
+    old->slots = NULL;
+    old->capacity = 0;
+    old->count = 0;
+  }
+}
+
+/// Makes room for one more node in the index, starting a new incremental resize if needed.
+/// @return 0 if there is room for the node, 1 otherwise.
+static int index_reserve(struct EventList* list) {
+  struct EventIndex* index = &list->index;
+  if ((index->count + 1) * 2 <= index->capacity) return 0;
+
+  // Finish the previous migration so there is only ever one old index
+  index_migrate(list, SIZE_MAX);
+
+  size_t capacity = index->capacity == 0 ? INDEX_INITIAL_CAPACITY : index->capacity * 2;
+  struct ListNode** slots = calloc(capacity, sizeof(struct ListNode*));
+  if (!slots) return 1;
+
+  list->old_index = *index;
+  list->migrate_pos = 0;
+  index->slots = slots;
+  index->capacity = capacity;
+  index->count = 0;
+
+  return 0;
+}
 
 struct EventList* create_list() {
   struct EventList* list = (struct EventList*)malloc(sizeof(struct EventList));
@@ -12,18 +125,144 @@ struct EventList* create_list() {
   }
   list->head = NULL;
   list->tail = NULL;
+  list->index = (struct EventIndex){NULL, 0, 0};
+  list->old_index = (struct EventIndex){NULL, 0, 0};
+  list->migrate_pos = 0;
+  list->slabs = NULL;
+  list->slab_used = 0;
+  list->free_nodes = NULL;
   return list;
 }
 
+/// Takes a node from the free nodes or the slabs of the list.
+/// @return Uninitialized node, NULL on failure
+static struct ListNode* alloc_node(struct EventList* list) {
+  if (list->free_nodes != NULL) {
+    struct ListNode* node = list->free_nodes;
+    list->free_nodes = node->next;
+    return node;
+  }
+
+  if (list->slabs == NULL || list->slab_used == NODE_SLAB_SIZE) {
+    struct NodeSlab* slab = malloc(sizeof(struct NodeSlab) + NODE_SLAB_SIZE * sizeof(struct ListNode));
+    if (!slab) return NULL;
+
+    slab->next = list->slabs;
+    list->slabs = slab;
+    list->slab_used = 0;
+  }
+
+  return &list->slabs->nodes[list->slab_used++];
+}
+
+static void release_node(struct EventList* list, struct ListNode* node) {
+  node->next = list->free_nodes;
+  list->free_nodes = node;
+}
+
+/// Gets the offsets of the bitmap and the tiles in the block of an event.
+/// @param num_seats Number of seats of the event.
+/// @param occupied_offset Pointer to store the offset of the bitmap in.
+/// @param tiles_offset Pointer to store the offset of the array of tiles in.
+/// @return Size of the block.
+static size_t event_layout(size_t num_seats, size_t* occupied_offset, size_t* tiles_offset) {
+  size_t num_tiles = (num_seats + SEAT_TILE_SIZE - 1) / SEAT_TILE_SIZE;
+  *occupied_offset = cache_line_round(sizeof(struct Event));
+  *tiles_offset = *occupied_offset + cache_line_round((num_seats + 63) / 64 * sizeof(uint64_t));
+  return *tiles_offset + cache_line_round(num_tiles * sizeof(struct TileSlot));
+}
+
+struct Event* create_event(unsigned int event_id, size_t num_rows, size_t num_cols) {
+  size_t occupied_offset, tiles_offset;
+  size_t block_size = event_layout(num_rows * num_cols, &occupied_offset, &tiles_offset);
+
+  char* block = aligned_alloc(CACHE_LINE_SIZE, block_size);
+  if (!block) return NULL;
+
+  struct Event* event = (struct Event*)block;
+  event->id = event_id;
+  event->seq = 0;
+  event->rows = num_rows;
+  event->cols = num_cols;
+  atomic_init(&event->reservations, 0);
+  event->occupied = (_Atomic(uint64_t)*)(block + occupied_offset);
+  event->tiles = (struct TileSlot*)(block + tiles_offset);
+  memset(block + occupied_offset, 0, tiles_offset - occupied_offset);
+
+  for (size_t i = 0; i < num_tiles(event); i++) {
+    if (pthread_mutex_init(&event->tiles[i].mutex, NULL) != 0) {
+      while (i-- > 0) {
+        pthread_mutex_destroy(&event->tiles[i].mutex);
+      }
+      free(block);
+      return NULL;
+    }
+
+    atomic_init(&event->tiles[i].tile, NULL);
+    atomic_init(&event->tiles[i].state, 0);
+  }
+
+  return event;
+}
+
+size_t num_tiles(struct Event* event) { return (event->rows * event->cols + SEAT_TILE_SIZE - 1) / SEAT_TILE_SIZE; }
+
+size_t tile_seats(struct Event* event, size_t tile) {
+  size_t num_seats = event->rows * event->cols;
+  return num_seats - tile * SEAT_TILE_SIZE < SEAT_TILE_SIZE ? num_seats - tile * SEAT_TILE_SIZE : SEAT_TILE_SIZE;
+}
+
+unsigned int get_seat(const unsigned char* seats, unsigned char width, size_t index) {
+  uint16_t value16;
+  uint32_t value32;
+
+  switch (width) {
+    case 1:
+      return seats[index];
+    case 2:
+      memcpy(&value16, seats + index * 2, sizeof(uint16_t));
+      return value16;
+    default:
+      memcpy(&value32, seats + index * 4, sizeof(uint32_t));
+      return value32;
+  }
+}
+
+void set_seat(unsigned char* seats, unsigned char width, size_t index, unsigned int reservation_id) {
+  uint16_t value16 = (uint16_t)reservation_id;
+  uint32_t value32 = reservation_id;
+
+  switch (width) {
+    case 1:
+      seats[index] = (unsigned char)reservation_id;
+      break;
+    case 2:
+      memcpy(seats + index * 2, &value16, sizeof(uint16_t));
+      break;
+    default:
+      memcpy(seats + index * 4, &value32, sizeof(uint32_t));
+      break;
+  }
+}
+
 int append_to_list(struct EventList* list, struct Event* event) {
   if (!list) return 1;
 
-  struct ListNode* new_node = (struct ListNode*)malloc(sizeof(struct ListNode));
+  struct ListNode* new_node = alloc_node(list);
   if (!new_node) return 1;
 
   new_node->event = event;
+  new_node->prev = list->tail;
   new_node->next = NULL;
 
+  if (index_reserve(list) != 0) {
+    release_node(list, new_node);
+    return 1;
+  }
+
+  index_insert(&list->index, new_node);
+  index_migrate(list, INDEX_MIGRATE_STEP);
+
   if (list->head == NULL) {
     list->head = new_node;
     list->tail = new_node;
@@ -35,40 +274,70 @@ int append_to_list(struct EventList* list, struct Event* event) {
   return 0;
 }
 
-static void free_event(struct Event* event) {
+struct Event* remove_from_list(struct EventList* list, unsigned int event_id) {
+  if (!list) return NULL;
+
+  // Backward shifting could move nodes of the old index behind the migration position, finish it first
+  index_migrate(list, SIZE_MAX);
+
+  struct ListNode* node = index_find(&list->index, event_id);
+  if (node == NULL) return NULL;
+
+  index_remove(&list->index, event_id);
+
+  if (node->prev) {
+    node->prev->next = node->next;
+  } else {
+    list->head = node->next;
+  }
+
+  if (node->next) {
+    node->next->prev = node->prev;
+  } else {
+    list->tail = node->prev;
+  }
+
+  struct Event* event = node->event;
+  release_node(list, node);
+  return event;
+}
+
+void free_event(struct Event* event) {
   if (!event) return;
-  free(event->data);
+  for (size_t i = 0; i < num_tiles(event); i++) {
+    pthread_mutex_destroy(&event->tiles[i].mutex);
+    free(atomic_load(&event->tiles[i].tile));
+  }
+
   free(event);
 }
 
 void free_list(struct EventList* list) {
   if (!list) return;
 
-  struct ListNode* current = list->head;
-  while (current) {
-    struct ListNode* temp = current;
-    current = current->next;
+  for (struct ListNode* current = list->head; current; current = current->next) {
+    free_event(current->event);
+  }
 
-    free_event(temp->event);
+  // Nodes are only released with their slabs
+  while (list->slabs) {
+    struct NodeSlab* temp = list->slabs;
+    list->slabs = temp->next;
     free(temp);
   }
 
+  free(list->index.slots);
+  free(list->old_index.slots);
   free(list);
 }
 
-struct Event* get_event(struct EventList* list, unsigned int event_id, struct ListNode* from, struct ListNode* to) {
-  if (!list || !from || !to) return NULL;
-  struct ListNode* current = from;
-
-  while (1) {
-    if (current->event->id == event_id) {
-      return current->event;
-    }
-
-    if (current == to) {
-      return NULL;
-    }
+struct Event* get_event(struct EventList* list, unsigned int event_id) {
+  if (!list) return NULL;
 
-    current = current->next;
+  struct ListNode* node = index_find(&list->index, event_id);
+  if (node == NULL) {
+    node = index_find(&list->old_index, event_id);
   }
+
+  return node ? node->event : NULL;
 }
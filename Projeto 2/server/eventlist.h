@@ -2,52 +2,138 @@
 #define SERVER_EVENT_LIST_H
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
+
+// Reservations of up to SEAT_TILE_SIZE consecutive seats, allocated when the first of them is reserved
+struct SeatTile {
+  unsigned char width;      /// Bytes per seat (1, 2 or 4), a wider tile replaces this one when a reservation does not fit.
+  unsigned char seats[];    /// Reservation of each seat of the tile.
+};
+
+#define CACHE_LINE_SIZE 64
+
+// The state of a tile counts the reservations writing to it without its mutex in the low bits, and its version in the
+// high bits. The version is odd while a reservation holding the mutex is writing to the tile.
+#define TILE_WRITERS_MASK 0xFFFFUL
+#define TILE_VERSION_UNIT (TILE_WRITERS_MASK + 1)
+
+// Lock and state of the seats of a tile, kept in the event block even while the tile is not allocated
+struct TileSlot {
+  _Alignas(CACHE_LINE_SIZE) _Atomic(struct SeatTile*) tile;  /// Reservations of the tile, NULL while it has none.
+  pthread_mutex_t mutex;  // Mutex to protect the tile from concurrent reservations that allocate or widen it
+  atomic_ulong state;     // Writers and version of the tile
+};
 
 struct Event {
   unsigned int id;            /// Event id
-  unsigned int reservations;  /// Number of reservations for the event.
+  unsigned long seq;          /// Creation order of the event across all the lists.
+  atomic_uint reservations;   /// Number of reservations for the event.
 
   size_t cols;  /// Number of columns.
   size_t rows;  /// Number of rows.
 
-  unsigned int* data;     /// Array of size rows * cols with the reservations for each seat.
-  pthread_mutex_t mutex;  // Mutex to protect the event
+  struct TileSlot* tiles;       /// Array of tiles covering the rows * cols seats, each with its own lock.
+  _Atomic(uint64_t)* occupied;  /// Bitmap of size rows * cols, a set bit means the seat is reserved (or being).
 };
 
 struct ListNode {
   struct Event* event;
+  struct ListNode* prev;
   struct ListNode* next;
 };
 
+// Open addressing (linear probing) hash table from event ids to list nodes
+struct EventIndex {
+  struct ListNode** slots;  // Array of capacity slots, NULL when empty
+  size_t capacity;          // Number of slots, always a power of two (or 0)
+  size_t count;             // Number of used slots
+};
+
+// Block of list nodes, so that nodes are not allocated one by one
+struct NodeSlab {
+  struct NodeSlab* next;
+  struct ListNode nodes[];
+};
+
 // Linked list structure
 struct EventList {
-  struct ListNode* head;  // Head of the list
-  struct ListNode* tail;  // Tail of the list
-  pthread_rwlock_t rwl;   // Mutex to protect the list
+  struct ListNode* head;        // Head of the list
+  struct ListNode* tail;        // Tail of the list
+  struct EventIndex index;      // Index used for lookups and insertions
+  struct EventIndex old_index;  // Previous index, still being migrated into index after a resize
+  size_t migrate_pos;           // Next slot of old_index to be migrated
+  struct NodeSlab* slabs;       // Blocks of nodes, the first one is the one being filled
+  size_t slab_used;             // Number of nodes taken from the first slab
+  struct ListNode* free_nodes;  // Nodes of removed events, linked by next
+  pthread_rwlock_t rwl;         // Mutex to protect the list
 };
 
 /// Creates a new event list.
 /// @return Newly created event list, NULL on failure
 struct EventList* create_list();
 
+/// Creates a new event with no reservations.
+/// @note The event, its bitmap and the locks of its tiles are allocated as a single cache line aligned block, the
+/// seats of the tiles are only allocated by reservations.
+/// @param event_id Event id.
+/// @param num_rows Number of rows.
+/// @param num_cols Number of columns.
+/// @return Newly created event, NULL on failure
+struct Event* create_event(unsigned int event_id, size_t num_rows, size_t num_cols);
+
 /// Appends a new node to the list.
+/// @note The event id must not be in the list yet.
 /// @param list Event list to be modified.
 /// @param data Event to be stored in the new node.
 /// @return 0 if the node was appended successfully, 1 otherwise.
 int append_to_list(struct EventList* list, struct Event* data);
 
-/// Removes a node from the list.
+/// Removes the node of an event from the list.
+/// @note The event itself is not freed.
 /// @param list Event list to be modified.
-/// @return 0 if the node was removed successfully, 1 otherwise.
+/// @param event_id Id of the event to be removed.
+/// @return Removed event, NULL if it was not in the list.
+struct Event* remove_from_list(struct EventList* list, unsigned int event_id);
+
+/// Gets the number of tiles of an event.
+/// @param event Event with the tiles.
+/// @return Number of tiles.
+size_t num_tiles(struct Event* event);
+
+/// Gets the number of seats in a tile of an event.
+/// @param event Event with the tile.
+/// @param tile Index of the tile.
+/// @return Number of seats, only the last tile may have less than SEAT_TILE_SIZE.
+size_t tile_seats(struct Event* event, size_t tile);
+
+/// Gets the reservation id of a seat.
+/// @param seats Array of seats.
+/// @param width Bytes per seat.
+/// @param index Index of the seat.
+/// @return Reservation id of the seat.
+unsigned int get_seat(const unsigned char* seats, unsigned char width, size_t index);
+
+/// Sets the reservation id of a seat.
+/// @param seats Array of seats.
+/// @param width Bytes per seat, big enough for the reservation id.
+/// @param index Index of the seat.
+/// @param reservation_id Reservation id to store.
+void set_seat(unsigned char* seats, unsigned char width, size_t index, unsigned int reservation_id);
+
+/// Frees an event and its tiles.
+/// @param event Event to be freed.
+void free_event(struct Event* event);
+
+/// Frees the list, all its events and its node slabs.
+/// @param list Event list to be freed.
 void free_list(struct EventList* list);
 
 /// Retrieves an event in the list.
 /// @param list Event list to be searched
 /// @param event_id Event id.
-/// @param from First node to be searched.
-/// @param to Last node to be searched.
 /// @return Pointer to the event if found, NULL otherwise.
-struct Event* get_event(struct EventList* list, unsigned int event_id, struct ListNode* from, struct ListNode* to);
+struct Event* get_event(struct EventList* list, unsigned int event_id);
 
 #endif  // SERVER_EVENT_LIST_H
@@ -1,209 +1,304 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/fcntl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <signal.h>
 #include <errno.h>
+#include <string.h>
 
 #include "common/constants.h"
 #include "common/io.h"
+#include "common/protocol.h"
 #include "operations.h"
 
+// A connected client, served by whichever worker is woken up by a request in its pipe
 typedef struct {
   int session_id;
-} ThreadArgs;
+  int req_pipe_fd, resp_pipe_fd;
+  struct SharedRings *rings;  // Carry the requests and responses instead of the pipes, NULL if the client did not ask
+} Session;
 
-typedef struct {
-  char *req_pipe_path, *resp_pipe_path;
-} ClientArgs;
-
-pthread_mutex_t clientMutex;
-pthread_cond_t clientCond;
-
-ClientArgs clients[MAX_SESSION_COUNT];
-int clientCount = 0;
-int signal_flag = 0;
+int epollFd;  // Request pipes of the sessions, each armed for a single wake up at a time
+sem_t dumpRequests;
 
 sigset_t mask;
 
-// Funtion to handle SIGUSR1
+// Funtion to handle SIGUSR1, the state is printed by the dumper thread
 void sigusr1_handler(int signo) {
-  signal_flag = 1;
+  (void)signo;
+  sem_post(&dumpRequests);
 }
 
-void *consumer(void *args) {
-
-  ThreadArgs *threadArgs = (ThreadArgs *)args;
-  int client_available, session_id = threadArgs->session_id;
-
+// Prints the state on each SIGUSR1, away from the loop registering sessions
+void *dumper(void *args) {
+  (void)args;
   pthread_sigmask(SIG_BLOCK, &mask, NULL);
 
   while (1) {
-    pthread_mutex_lock(&clientMutex);
-    while (clientCount == 0) {
-      pthread_cond_wait(&clientCond, &clientMutex);
-    }
-    client_available = 1;
-    char *req_pipe_path = clients[clientCount - 1].req_pipe_path;
-    char *resp_pipe_path = clients[clientCount - 1].resp_pipe_path;
-    clientCount--;
-    pthread_mutex_unlock(&clientMutex);
-
-    int req_pipe_fd = open(req_pipe_path, O_RDONLY);
-    if (req_pipe_fd == -1) {
-      fprintf(stderr, "Failed to open req_pipe_fd\n");
+    if (sem_wait(&dumpRequests) == -1) continue;
+
+    // Signals received before the dump starts are served by it
+    while (sem_trywait(&dumpRequests) == 0) {
     }
 
-    int resp_pipe_fd = open(resp_pipe_path, O_WRONLY);
-    if (resp_pipe_fd == -1) {
-      fprintf(stderr, "Failed to open req_pipe_fd\n");
+    ems_print_all(STDOUT_FILENO);
+  }
+}
+
+/// Reads the commands of a BATCH request.
+/// @param reader Reader of the payload of the request.
+/// @param commands Array to store the commands in, of MAX_BATCH_COMMANDS commands.
+/// @param num_commands Pointer to store the number of commands in.
+/// @param seats Array to store the seats of the reservations in, as large as the payload.
+/// @return 0 if the commands were read, 1 if the request is malformed.
+static int read_batch(struct PayloadReader *reader, struct BatchCommand *commands, size_t *num_commands, size_t *seats) {
+  if (payload_take(reader, num_commands, sizeof(size_t)) || *num_commands > MAX_BATCH_COMMANDS) {
+    return 1;
+  }
+
+  for (size_t i = 0; i < *num_commands; i++) {
+    struct BatchCommand *command = &commands[i];
+    if (payload_take(reader, &command->op, sizeof(uint8_t))) {
+      return 1;
     }
 
-    if (write(resp_pipe_fd, &session_id, sizeof(int)) == -1) {
-      fprintf(stderr, "Failed to write session_id\n");
+    switch (command->op) {
+      case OP_CREATE:
+        if (payload_take(reader, &command->event_id, sizeof(unsigned int)) ||
+            payload_take(reader, &command->num_rows, sizeof(size_t)) ||
+            payload_take(reader, &command->num_cols, sizeof(size_t))) {
+          return 1;
+        }
+        break;
+
+      case OP_RESERVE:
+        if (payload_take(reader, &command->event_id, sizeof(unsigned int)) ||
+            payload_take(reader, &command->num_seats, sizeof(size_t)) || command->num_seats > MAX_RESERVATION_SIZE) {
+          return 1;
+        }
+
+        // The seats take as many bytes in the array as in the payload, so they always fit
+        command->xs = seats;
+        command->ys = seats + command->num_seats;
+        seats += 2 * command->num_seats;
+        if (payload_take(reader, command->xs, sizeof(size_t) * command->num_seats) ||
+            payload_take(reader, command->ys, sizeof(size_t) * command->num_seats)) {
+          return 1;
+        }
+        break;
+
+      case OP_SHOW:
+        if (payload_take(reader, &command->event_id, sizeof(unsigned int))) {
+          return 1;
+        }
+        break;
+
+      case OP_LIST_EVENTS:
+        command->event_id = 0;
+        break;
+
+      default:
+        return 1;
     }
+  }
+
+  return reader->left != 0;
+}
+
+/// Serves the next request of a session.
+/// @param session The session.
+/// @return 0 if the session is still open, 1 if the client quit or can not be answered anymore.
+static int serve_request(Session *session) {
+  struct FrameHeader request;
+  unsigned char payload[MAX_REQUEST_PAYLOAD];
+
+  // A client that is gone or sent a malformed request can not be answered anymore
+  if (recv_frame(session->req_pipe_fd, &request, payload, sizeof(payload))) {
+    fprintf(stderr, "Failed to read request\n");
+    request.op = OP_QUIT;
+  }
+
+  struct PayloadReader reader;
+  payload_init(&reader, payload, request.length);
+
+  unsigned int event_id;
+  size_t num_rows, num_columns, num_coords, num_commands;
+  size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+  struct BatchCommand commands[MAX_BATCH_COMMANDS];
+  size_t seats[MAX_REQUEST_PAYLOAD / sizeof(size_t)];
+
+  switch (request.op) {
+    case OP_QUIT:
+      return 1;
+
+    case OP_CREATE:
+      if (payload_take(&reader, &event_id, sizeof(unsigned int)) ||
+          payload_take(&reader, &num_rows, sizeof(size_t)) || payload_take(&reader, &num_columns, sizeof(size_t))) {
+        send_status(session->resp_pipe_fd, &request, 1);
+        fprintf(stderr, "Failed to read create request\n");
+        break;
+      }
+
+      if (ems_create(event_id, num_rows, num_columns)) {
+        send_status(session->resp_pipe_fd, &request, 1);
+        fprintf(stderr, "Failed to create event\n");
+        break;
+      }
+
+      if (send_status(session->resp_pipe_fd, &request, 0)) {
+        fprintf(stderr, "Failed to write response\n");
+      }
+      break;
+
+    case OP_RESERVE:
+      if (payload_take(&reader, &event_id, sizeof(unsigned int)) ||
+          payload_take(&reader, &num_coords, sizeof(size_t)) || num_coords > MAX_RESERVATION_SIZE ||
+          payload_take(&reader, xs, sizeof(size_t) * num_coords) ||
+          payload_take(&reader, ys, sizeof(size_t) * num_coords)) {
+        send_status(session->resp_pipe_fd, &request, 1);
+        fprintf(stderr, "Failed to read reserve request\n");
+        break;
+      }
+
+      if (ems_reserve(event_id, num_coords, xs, ys)) {
+        send_status(session->resp_pipe_fd, &request, 1);
+        fprintf(stderr, "Failed to reserve seats\n");
+        break;
+      }
+
+      if (send_status(session->resp_pipe_fd, &request, 0)) {
+        fprintf(stderr, "Failed to write response\n");
+      }
+      break;
+
+    case OP_SHOW:
+      if (payload_take(&reader, &event_id, sizeof(unsigned int))) {
+        send_status(session->resp_pipe_fd, &request, 1);
+        fprintf(stderr, "Failed to read show request\n");
+        break;
+      }
+
+      // The response, or the error status, is sent by ems_show
+      if (ems_show(session->resp_pipe_fd, &request, event_id)) {
+        fprintf(stderr, "Failed to show event\n");
+      }
+      break;
+
+    case OP_LIST_EVENTS:
+      if (ems_list_events(session->resp_pipe_fd, &request)) {
+        fprintf(stderr, "Failed to list events\n");
+      }
+      break;
 
-    while (1) {
-      char op_code;
+    case OP_DELETE:
+      if (payload_take(&reader, &event_id, sizeof(unsigned int))) {
+        send_status(session->resp_pipe_fd, &request, 1);
+        fprintf(stderr, "Failed to read delete request\n");
+        break;
+      }
 
-      if (!client_available) {
+      if (ems_delete(event_id)) {
+        send_status(session->resp_pipe_fd, &request, 1);
+        fprintf(stderr, "Failed to delete event\n");
         break;
       }
 
-      if (read(req_pipe_fd, &op_code, sizeof(char)) == -1) {
-        fprintf(stderr, "Failed to read op_code\n");
+      if (send_status(session->resp_pipe_fd, &request, 0)) {
+        fprintf(stderr, "Failed to write response\n");
       }
+      break;
 
-      if (read(req_pipe_fd, &session_id, sizeof(int)) == -1) {
-        fprintf(stderr, "Failed to read session_id\n");
+    case OP_BATCH:
+      if (read_batch(&reader, commands, &num_commands, seats)) {
+        send_status(session->resp_pipe_fd, &request, 1);
+        fprintf(stderr, "Failed to read batch request\n");
+        break;
       }
 
-      unsigned int event_id, response;
-      size_t num_rows, num_columns, num_coords;
-      size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
-
-      switch (op_code) {
-        case '2':
-          // ems_quit();
-
-          close(req_pipe_fd);
-          close(resp_pipe_fd);
-
-          client_available = 0;
-
-          break;
-
-        case '3':
-          // ems_create();
-
-          if (read(req_pipe_fd, &event_id, sizeof(unsigned int)) == -1) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to read event_id\n");
-          }
-
-          if (read(req_pipe_fd, &num_rows, sizeof(size_t)) == -1) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to read num_rows\n");
-            break;
-          }
-
-          if (read(req_pipe_fd, &num_columns, sizeof(size_t)) == -1) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to read num_columns\n");
-            break;
-          }
-
-          if (ems_create(event_id, num_rows, num_columns)) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to create event\n");
-            break;
-          }
-
-          response = 0;
-          if (write(resp_pipe_fd, &response, sizeof(unsigned int)) == -1) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to write response\n");
-            break;
-          }
-          break;
-
-        case '4':
-          // ems_reserve();
-
-          if (read(req_pipe_fd, &event_id, sizeof(unsigned int)) == -1) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to read event_id\n");
-            break;
-          }
-
-          if (read(req_pipe_fd, &num_coords, sizeof(size_t)) == -1) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to read num_coords\n");
-            break;
-          }
-
-          if (read(req_pipe_fd, xs, sizeof(size_t) * num_coords) == -1) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to read xs\n");
-            break;
-          }
-
-          if (read(req_pipe_fd, ys, sizeof(size_t) * num_coords) == -1) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to read ys\n");
-            break;
-          }
-
-          if (ems_reserve(event_id, num_coords, xs, ys)) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to reserve seats\n");
-            break;
-          }
-
-          response = 0;
-          if (write(resp_pipe_fd, &response, sizeof(unsigned int)) == -1) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to write response\n");
-            break;
-          }
-
-          break;
-
-        case '5':
-          // ems_show();
-
-          if (read(req_pipe_fd, &event_id, sizeof(unsigned int)) == -1) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to read event_id\n");
-            break;
-          }
-
-          if (ems_show(resp_pipe_fd, event_id)) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to show event\n");
-            break;
-          }
-
-          break;
-
-        case '6':
-          // ems_list_events();
-
-          if (ems_list_events(resp_pipe_fd)) {
-            error_msg(resp_pipe_fd);
-            fprintf(stderr, "Failed to list events\n");
-            break;
-          }
-
-          break;
-
-        default:
-          fprintf(stderr, "Invalid op_code\n");
-          break;
+      // The response, or the error status, is sent by ems_batch
+      if (ems_batch(session->resp_pipe_fd, &request, commands, num_commands)) {
+        fprintf(stderr, "Failed to run batch\n");
       }
+      break;
+
+    default:
+      send_status(session->resp_pipe_fd, &request, 1);
+      fprintf(stderr, "Invalid op_code\n");
+      break;
+  }
+
+  return 0;
+}
+
+/// Closes the pipes of a session and frees it.
+/// @param session The session.
+static void close_session(Session *session) {
+  if (session->rings != NULL) {
+    detach_ring(session->req_pipe_fd);
+    detach_ring(session->resp_pipe_fd);
+    shared_rings_close(session->rings);
+  }
+
+  free_read_buffer(session->req_pipe_fd);
+  close(session->req_pipe_fd);
+  close(session->resp_pipe_fd);
+  free(session);
+}
+
+/// Serves the requests a session has ready, after its pipe woke up a worker.
+/// @param session The session.
+/// @return 0 if the session waits for more requests, 1 if the client quit or can not be answered anymore.
+static int serve_ready(Session *session) {
+  if (session->rings == NULL) {
+    // Requests already read into the buffer of the pipe do not wake up epoll, so they are served now
+    do {
+      if (serve_request(session)) return 1;
+    } while (buffered_bytes(session->req_pipe_fd) > 0);
+
+    // The buffer is empty, idle sessions do not hold one
+    free_read_buffer(session->req_pipe_fd);
+    return 0;
+  }
+
+  // The pipe only holds the doorbell, or the end of file of a client that is gone
+  char doorbell[64];
+  if (read(session->req_pipe_fd, doorbell, sizeof(doorbell)) <= 0) return 1;
+
+  // The worker stays with the session while its client keeps sending requests
+  do {
+    while (ring_available(&session->rings->requests) > 0) {
+      if (serve_request(session)) return 1;
+    }
+  } while (!ring_idle(&session->rings->requests));
+
+  return 0;
+}
+
+// Serves the requests of whichever sessions have them, one worker per session at a time
+void *worker(void *args) {
+  (void)args;
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  while (1) {
+    struct epoll_event event;
+    if (epoll_wait(epollFd, &event, 1, -1) != 1) continue;
+
+    Session *session = event.data.ptr;
+    if (serve_ready(session)) {
+      close_session(session);
+      continue;
+    }
+
+    event.events = EPOLLIN | EPOLLONESHOT;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, session->req_pipe_fd, &event) == -1) {
+      fprintf(stderr, "Failed to wait for requests\n");
+      close_session(session);
     }
   }
 }
@@ -232,20 +327,43 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  signal(SIGUSR1, sigusr1_handler);
   sigemptyset(&mask);
   sigaddset(&mask, SIGUSR1);
 
-  pthread_mutex_init(&clientMutex, NULL);
-  pthread_cond_init(&clientCond, NULL);
+  // Reads of the server pipe are restarted, the accept loop does not handle the signal itself
+  struct sigaction action = {.sa_handler = sigusr1_handler, .sa_flags = SA_RESTART};
+  sigemptyset(&action.sa_mask);
+  if (sem_init(&dumpRequests, 0, 0) != 0 || sigaction(SIGUSR1, &action, NULL) != 0) {
+    fprintf(stderr, "Failed to handle SIGUSR1\n");
+    return 1;
+  }
+
+  // A client that quits without waiting for its responses must not stop the server
+  struct sigaction ignore = {.sa_handler = SIG_IGN};
+  sigemptyset(&ignore.sa_mask);
+  sigaction(SIGPIPE, &ignore, NULL);
+
+  pthread_t dumperThread;
+  pthread_create(&dumperThread, NULL, dumper, NULL);
+
+  // Each session holds two descriptors, so allow as many as the system does
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  epollFd = epoll_create1(0);
+  if (epollFd == -1) {
+    perror("epoll_create1");
+    return 1;
+  }
 
-  // Create consumer threads
-  pthread_t threads[MAX_SESSION_COUNT];
-  ThreadArgs threadArgs[MAX_SESSION_COUNT];
+  // Create worker threads, shared by all the sessions
+  pthread_t threads[WORKER_COUNT];
 
-  for (int i = 0; i < MAX_SESSION_COUNT; i++) {
-    threadArgs[i].session_id = i + 1;
-    pthread_create(&threads[i], NULL, consumer, &threadArgs[i]);
+  for (int i = 0; i < WORKER_COUNT; i++) {
+    pthread_create(&threads[i], NULL, worker, NULL);
   }
 
   // Get the pipe path
@@ -266,40 +384,86 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  // Kept open so that reads block, instead of returning end of file, while no client is connecting
+  int server_write_fd = open(pipe_path, O_WRONLY);
+  if (server_write_fd == -1) {
+    perror("open");
+    return 1;
+  }
+
+  int next_session_id = 1;
+
   while (1) {
-    if (signal_flag) {
-      ems_print_all(STDOUT_FILENO);
-      signal_flag = 0;
+    struct FrameHeader request;
+    char paths[3 * MAX_PIPE_PATH_SIZE];
+    char req_pipe_path[MAX_PIPE_PATH_SIZE + 1], resp_pipe_path[MAX_PIPE_PATH_SIZE + 1];
+    char shm_name[MAX_PIPE_PATH_SIZE + 1];
+
+    if (recv_frame(server_fd, &request, paths, sizeof(paths))) {
+      fprintf(stderr, "Failed to read setup request\n");
+      continue;
     }
 
-    char op_code = '0';
-    char req_pipe_path[MAX_PIPE_PATH_SIZE], resp_pipe_path[MAX_PIPE_PATH_SIZE];
-    ClientArgs client;
-    ssize_t char_read;
+    if (request.op != OP_SETUP || (request.length != 2 * MAX_PIPE_PATH_SIZE && request.length != sizeof(paths)))
+      continue;
+
+    memcpy(req_pipe_path, paths, MAX_PIPE_PATH_SIZE);
+    memcpy(resp_pipe_path, paths + MAX_PIPE_PATH_SIZE, MAX_PIPE_PATH_SIZE);
+    req_pipe_path[MAX_PIPE_PATH_SIZE] = '\0';
+    resp_pipe_path[MAX_PIPE_PATH_SIZE] = '\0';
 
-    if ((char_read = read(server_fd, &op_code, sizeof(char))) == -1)
-      fprintf(stderr, "Failed to read op_code\n");
-    else if (char_read == 0)
+    Session *session = malloc(sizeof(Session));
+    if (session == NULL) {
+      fprintf(stderr, "Failed to allocate session\n");
       continue;
+    }
+
+    // The client opens its pipes right after sending the setup request, in this order
+    session->session_id = next_session_id++;
+    session->rings = NULL;
+    session->req_pipe_fd = open(req_pipe_path, O_RDONLY);
+    if (session->req_pipe_fd == -1) {
+      fprintf(stderr, "Failed to open req_pipe_fd\n");
+      free(session);
+      continue;
+    }
 
-    if (op_code != '1')
+    session->resp_pipe_fd = open(resp_pipe_path, O_WRONLY);
+    if (session->resp_pipe_fd == -1) {
+      fprintf(stderr, "Failed to open resp_pipe_fd\n");
+      close(session->req_pipe_fd);
+      free(session);
       continue;
+    }
 
-    if (read(server_fd, req_pipe_path, sizeof(char) * MAX_PIPE_PATH_SIZE) == -1) {
-      fprintf(stderr, "Failed to read req_pipe_path\n");
+    // A client whose shared memory can not be mapped is served through its pipes
+    if (request.length == sizeof(paths)) {
+      memcpy(shm_name, paths + 2 * MAX_PIPE_PATH_SIZE, MAX_PIPE_PATH_SIZE);
+      shm_name[MAX_PIPE_PATH_SIZE] = '\0';
+      session->rings = shared_rings_open(shm_name);
     }
 
-    if (read(server_fd, resp_pipe_path, sizeof(char) * MAX_PIPE_PATH_SIZE) == -1) {
-      fprintf(stderr, "Failed to read resp_pipe_path\n");
+    int shared = session->rings != NULL;
+    struct iovec payload = {.iov_base = &shared, .iov_len = sizeof(int)};
+    if (send_frame(session->resp_pipe_fd, OP_SETUP, request.request_id, session->session_id, &payload, 1)) {
+      fprintf(stderr, "Failed to write session_id\n");
+      close_session(session);
+      continue;
     }
 
-    client.req_pipe_path = req_pipe_path;
-    client.resp_pipe_path = resp_pipe_path;
+    // Attached before the workers can see the session, the first request comes right after the response
+    if (shared && (attach_ring(session->req_pipe_fd, &session->rings->requests) ||
+                   attach_ring(session->resp_pipe_fd, &session->rings->responses))) {
+      fprintf(stderr, "Failed to attach shared memory\n");
+      close_session(session);
+      continue;
+    }
 
-    pthread_mutex_lock(&clientMutex);
-    clients[clientCount] = client;
-    clientCount++;
-    pthread_cond_signal(&clientCond);
-    pthread_mutex_unlock(&clientMutex);
+    // From now on the session is served by the workers
+    struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = session};
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, session->req_pipe_fd, &event) == -1) {
+      fprintf(stderr, "Failed to wait for requests\n");
+      close_session(session);
+    }
   }
-}
\ No newline at end of file
+}
@@ -1,26 +1,37 @@
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "common/constants.h"
 #include "common/io.h"
+#include "common/protocol.h"
+#include "epoch.h"
 #include "eventlist.h"
+#include "operations.h"
 
-static struct EventList* event_list = NULL;
+static struct EventList* event_shards[EVENT_SHARD_COUNT];  // Events split by id, each shard with its own rwl
+static int initialized = 0;
+static atomic_ulong next_event_seq = 0;  // Creation order of the next event, shared by all shards
 static unsigned int state_access_delay_us = 0;
 
+/// Gets the shard that holds the event with the given ID.
+/// @param event_id The ID of the event.
+/// @return Shard of the event.
+static struct EventList* shard_of(unsigned int event_id) { return event_shards[event_id % EVENT_SHARD_COUNT]; }
+
 /// Gets the event with the given ID from the state.
 /// @note Will wait to simulate a real system accessing a costly memory resource.
 /// @param event_id The ID of the event to get.
-/// @param from First node to be searched.
-/// @param to Last node to be searched.
 /// @return Pointer to the event if found, NULL otherwise.
-static struct Event* get_event_with_delay(unsigned int event_id, struct ListNode* from, struct ListNode* to) {
+static struct Event* get_event_with_delay(unsigned int event_id) {
   struct timespec delay = {0, state_access_delay_us * 1000};
   nanosleep(&delay, NULL);  // Should not be removed
 
-  return get_event(event_list, event_id, from, to);
+  return get_event(shard_of(event_id), event_id);
 }
 
 /// Gets the index of a seat.
@@ -31,13 +42,306 @@ static struct Event* get_event_with_delay(unsigned int event_id, struct ListNode
 /// @return Index of the seat.
 static size_t seat_index(struct Event* event, size_t row, size_t col) { return (row - 1) * event->cols + col - 1; }
 
-void error_msg(int out_fd) {
-  int error_code = 1;
-  if (write(out_fd, &error_code, sizeof(int)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
+/// Claims seats in the occupancy bitmap of an event, all or none of them.
+/// @param event Event with the seats.
+/// @param num_seats Number of seats.
+/// @param xs Array of rows of the seats.
+/// @param ys Array of columns of the seats.
+/// @return 0 if every seat was claimed, 1 if one of them was already reserved.
+static int claim_seats(struct Event* event, size_t num_seats, size_t* xs, size_t* ys) {
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t index = seat_index(event, xs[i], ys[i]);
+    uint64_t bit = (uint64_t)1 << (index % 64);
+
+    if (atomic_fetch_or(&event->occupied[index / 64], bit) & bit) {
+      // Give back the seats claimed so far
+      while (i-- > 0) {
+        index = seat_index(event, xs[i], ys[i]);
+        atomic_fetch_and(&event->occupied[index / 64], ~((uint64_t)1 << (index % 64)));
+      }
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/// Gives back seats claimed by claim_seats.
+static void release_seats(struct Event* event, size_t num_seats, size_t* xs, size_t* ys) {
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t index = seat_index(event, xs[i], ys[i]);
+    atomic_fetch_and(&event->occupied[index / 64], ~((uint64_t)1 << (index % 64)));
+  }
+}
+
+/// Copies the tiles of an event that have reservations, without taking their mutexes.
+/// @note Retries whenever a reservation was written to the event during the copy: the state of every tile is read
+/// before copying and checked again after copying all of them, so the copy is consistent across tiles.
+/// @param event Event to copy the seats from.
+/// @param size Pointer to store the size of the copy in.
+/// @return Copy with the width of each tile (0 if it has no reservations) followed by the seats of the tiles with
+/// reservations, NULL on failure.
+static unsigned char* snapshot_seats(struct Event* event, size_t* size) {
+  size_t tiles = num_tiles(event);
+  unsigned long* states = malloc(tiles * sizeof(unsigned long) + 1);
+  if (states == NULL) return NULL;
+
+  while (1) {
+    int changed = 0;
+    *size = tiles;
+    for (size_t i = 0; i < tiles && !changed; i++) {
+      states[i] = atomic_load_explicit(&event->tiles[i].state, memory_order_acquire);
+      changed = (states[i] & TILE_WRITERS_MASK) != 0 || (states[i] / TILE_VERSION_UNIT) % 2 != 0;
+
+      struct SeatTile* tile = atomic_load_explicit(&event->tiles[i].tile, memory_order_acquire);
+      if (tile != NULL) *size += tile->width * tile_seats(event, i);
+    }
+
+    if (changed) {
+      sched_yield();
+      continue;
+    }
+
+    unsigned char* snapshot = malloc(*size + 1);
+    if (snapshot == NULL) {
+      free(states);
+      return NULL;
+    }
+
+    size_t offset = tiles;
+    for (size_t i = 0; i < tiles; i++) {
+      struct SeatTile* tile = atomic_load_explicit(&event->tiles[i].tile, memory_order_acquire);
+      snapshot[i] = tile != NULL ? tile->width : 0;
+      if (tile == NULL) continue;
+
+      // The tile was allocated or widened after computing the size
+      size_t bytes = tile->width * tile_seats(event, i);
+      if (offset + bytes > *size) {
+        changed = 1;
+        break;
+      }
+
+      memcpy(snapshot + offset, tile->seats, bytes);
+      offset += bytes;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    for (size_t i = 0; i < tiles && !changed; i++) {
+      changed = atomic_load_explicit(&event->tiles[i].state, memory_order_relaxed) != states[i];
+    }
+
+    if (!changed && offset == *size) {
+      free(states);
+      return snapshot;
+    }
+
+    free(snapshot);
+  }
+}
+
+/// Gets the bytes per seat needed to store a reservation id.
+static unsigned char seat_width(unsigned int reservation_id) {
+  return reservation_id <= UINT8_MAX ? 1 : reservation_id <= UINT16_MAX ? 2 : 4;
+}
+
+/// Gets a tile of an event that can store the given reservation id, allocating or widening it if needed.
+/// @note The tile must be locked by lock_tiles. Readers may still be copying a tile that is widened, so
+/// it is retired instead of freed.
+/// @param event Event with the tile.
+/// @param index Index of the tile.
+/// @param reservation_id Reservation id that will be stored.
+/// @return Tile, NULL on failure.
+static struct SeatTile* writable_tile(struct Event* event, size_t index, unsigned int reservation_id) {
+  unsigned char width = seat_width(reservation_id);
+  struct SeatTile* old_tile = atomic_load_explicit(&event->tiles[index].tile, memory_order_relaxed);
+  if (old_tile != NULL && old_tile->width >= width) return old_tile;
+
+  size_t num_seats = tile_seats(event, index);
+  struct SeatTile* tile = calloc(1, sizeof(struct SeatTile) + num_seats * width);
+  if (tile == NULL) return NULL;
+
+  tile->width = width;
+  if (old_tile != NULL) {
+    for (size_t i = 0; i < num_seats; i++) {
+      set_seat(tile->seats, width, i, get_seat(old_tile->seats, old_tile->width, i));
+    }
+  }
+
+  atomic_store_explicit(&event->tiles[index].tile, tile, memory_order_release);
+
+  if (old_tile != NULL && epoch_retire(old_tile, free) != 0) {
+    fprintf(stderr, "Error retiring tile, it will not be freed\n");
+  }
+
+  return tile;
+}
+
+static int compare_size(const void* a, const void* b) {
+  size_t x = *(const size_t*)a, y = *(const size_t*)b;
+  return (x > y) - (x < y);
+}
+
+/// Gets the tiles of the given seats.
+/// @note The seats must exist.
+/// @param event Event with the tiles.
+/// @param num_seats Number of seats.
+/// @param xs Array of rows of the seats.
+/// @param ys Array of columns of the seats.
+/// @param tiles Array of num_seats elements to store the indexes of the tiles in, in increasing order.
+/// @return Number of different tiles.
+static size_t seat_tiles(struct Event* event, size_t num_seats, size_t* xs, size_t* ys, size_t* tiles) {
+  for (size_t i = 0; i < num_seats; i++) {
+    tiles[i] = seat_index(event, xs[i], ys[i]) / SEAT_TILE_SIZE;
+  }
+  qsort(tiles, num_seats, sizeof(size_t), compare_size);
+
+  size_t num_tiles = 0;
+  for (size_t i = 0; i < num_seats; i++) {
+    if (num_tiles == 0 || tiles[num_tiles - 1] != tiles[i]) {
+      tiles[num_tiles++] = tiles[i];
+    }
+  }
+
+  return num_tiles;
+}
+
+/// Locks tiles in increasing order, so that reservations can never deadlock.
+/// @note The version of each locked tile is left odd once the reservations writing to it without the mutex are done,
+/// so that neither readers nor those reservations touch it.
+/// @param event Event with the tiles.
+/// @param num_tiles Number of tiles.
+/// @param tiles Array of indexes of the tiles, in increasing order.
+static void lock_tiles(struct Event* event, size_t num_tiles, size_t* tiles) {
+  for (size_t i = 0; i < num_tiles; i++) {
+    struct TileSlot* slot = &event->tiles[tiles[i]];
+    pthread_mutex_lock(&slot->mutex);
+
+    unsigned long state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+    while ((state & TILE_WRITERS_MASK) != 0 ||
+           !atomic_compare_exchange_weak_explicit(&slot->state, &state, state + TILE_VERSION_UNIT,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+      if ((state & TILE_WRITERS_MASK) != 0) {
+        sched_yield();
+        state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+      }
+    }
+  }
+  atomic_thread_fence(memory_order_release);
+}
+
+/// Unlocks the tiles locked by lock_tiles, making their versions even again.
+static void unlock_tiles(struct Event* event, size_t num_tiles, size_t* tiles) {
+  for (size_t i = num_tiles; i-- > 0;) {
+    struct TileSlot* slot = &event->tiles[tiles[i]];
+    atomic_fetch_add_explicit(&slot->state, TILE_VERSION_UNIT, memory_order_release);
+    pthread_mutex_unlock(&slot->mutex);
+  }
+}
+
+/// Registers the calling thread as a writer of tiles that are not locked, without taking their mutexes.
+/// @param event Event with the tiles.
+/// @param num_tiles Number of tiles.
+/// @param tiles Array of indexes of the tiles.
+/// @return 0 if it is a writer of every tile, 1 if one of them is locked (and it is a writer of none).
+static int enter_tiles(struct Event* event, size_t num_tiles, size_t* tiles) {
+  for (size_t i = 0; i < num_tiles; i++) {
+    struct TileSlot* slot = &event->tiles[tiles[i]];
+
+    unsigned long state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+    do {
+      if ((state / TILE_VERSION_UNIT) % 2 != 0) {
+        while (i-- > 0) {
+          atomic_fetch_sub_explicit(&event->tiles[tiles[i]].state, 1, memory_order_relaxed);
+        }
+        return 1;
+      }
+    } while (!atomic_compare_exchange_weak_explicit(&slot->state, &state, state + 1, memory_order_acquire,
+                                                    memory_order_relaxed));
+  }
+
+  return 0;
+}
+
+/// Unregisters the calling thread as a writer of tiles registered by enter_tiles.
+/// @param event Event with the tiles.
+/// @param num_tiles Number of tiles.
+/// @param tiles Array of indexes of the tiles.
+/// @param written Whether seats of the tiles were written, changing their versions.
+static void leave_tiles(struct Event* event, size_t num_tiles, size_t* tiles, int written) {
+  for (size_t i = 0; i < num_tiles; i++) {
+    if (written) {
+      // Keeps the version even
+      atomic_fetch_add_explicit(&event->tiles[tiles[i]].state, 2 * TILE_VERSION_UNIT - 1, memory_order_release);
+    } else {
+      atomic_fetch_sub_explicit(&event->tiles[tiles[i]].state, 1, memory_order_relaxed);
+    }
   }
 }
 
+/// Writes a reservation to seats whose tiles are already wide enough for it.
+/// @note The seats must be claimed, and the calling thread a writer or the owner of the lock of their tiles.
+/// @param event Event with the seats.
+/// @param num_seats Number of seats.
+/// @param xs Array of rows of the seats.
+/// @param ys Array of columns of the seats.
+/// @param reservation_id Id of the reservation.
+/// @return 0 if the reservation was written, 1 if a tile is missing or too narrow (and nothing was written).
+static int write_seats(struct Event* event, size_t num_seats, size_t* xs, size_t* ys, unsigned int reservation_id) {
+  for (size_t i = 0; i < num_seats; i++) {
+    struct SeatTile* tile =
+        atomic_load_explicit(&event->tiles[seat_index(event, xs[i], ys[i]) / SEAT_TILE_SIZE].tile, memory_order_acquire);
+    if (tile == NULL || seat_width(reservation_id) > tile->width) return 1;
+  }
+
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t index = seat_index(event, xs[i], ys[i]);
+    struct SeatTile* tile = atomic_load_explicit(&event->tiles[index / SEAT_TILE_SIZE].tile, memory_order_relaxed);
+    set_seat(tile->seats, tile->width, index % SEAT_TILE_SIZE, reservation_id);
+  }
+
+  return 0;
+}
+
+/// Read-locks every shard, always in the same order.
+/// @return 0 if all the shards were locked, 1 otherwise (no shard is left locked).
+static int lock_all_shards() {
+  for (size_t i = 0; i < EVENT_SHARD_COUNT; i++) {
+    if (pthread_rwlock_rdlock(&event_shards[i]->rwl) != 0) {
+      while (i-- > 0) {
+        pthread_rwlock_unlock(&event_shards[i]->rwl);
+      }
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void unlock_all_shards() {
+  for (size_t i = 0; i < EVENT_SHARD_COUNT; i++) {
+    pthread_rwlock_unlock(&event_shards[i]->rwl);
+  }
+}
+
+/// Merges the shards by creation order.
+/// @note All shards must be locked.
+/// @param cursors Next node of each shard, advanced past the returned node.
+/// @return Oldest node among the cursors, NULL when all the shards were consumed.
+static struct ListNode* next_in_order(struct ListNode* cursors[EVENT_SHARD_COUNT]) {
+  size_t oldest = EVENT_SHARD_COUNT;
+  for (size_t i = 0; i < EVENT_SHARD_COUNT; i++) {
+    if (cursors[i] != NULL && (oldest == EVENT_SHARD_COUNT || cursors[i]->event->seq < cursors[oldest]->event->seq)) {
+      oldest = i;
+    }
+  }
+
+  if (oldest == EVENT_SHARD_COUNT) return NULL;
+
+  struct ListNode* node = cursors[oldest];
+  cursors[oldest] = node->next;
+  return node;
+}
+
 size_t get_num_events(struct ListNode* head) {
   size_t count = 0;
   struct ListNode* current = head;
@@ -49,335 +353,656 @@ size_t get_num_events(struct ListNode* head) {
   return count;
 }
 
-int ems_init(unsigned int delay_us) {
-  if (event_list != NULL) {
-    fprintf(stderr, "EMS state has already been initialized\n");
-    return 1;
+/// Gets the ids of all the events, by creation order.
+/// @note All shards must be locked.
+/// @param num_events Pointer to store the number of events in.
+/// @return Array with the ids of the events, NULL on failure.
+static unsigned int* collect_event_ids(size_t* num_events) {
+  struct ListNode* cursors[EVENT_SHARD_COUNT];
+  *num_events = 0;
+  for (size_t i = 0; i < EVENT_SHARD_COUNT; i++) {
+    cursors[i] = event_shards[i]->head;
+    *num_events += get_num_events(cursors[i]);
   }
 
-  event_list = create_list();
-  state_access_delay_us = delay_us;
+  unsigned int* event_ids = malloc(*num_events * sizeof(unsigned int) + 1);
+  if (event_ids == NULL) return NULL;
+
+  for (size_t i = 0; i < *num_events; i++) {
+    event_ids[i] = next_in_order(cursors)->event->id;
+  }
 
-  return event_list == NULL;
+  return event_ids;
 }
 
-int ems_terminate() {
-  if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
+int ems_init(unsigned int delay_us) {
+  if (initialized) {
+    fprintf(stderr, "EMS state has already been initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_wrlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
-    return 1;
+  for (size_t i = 0; i < EVENT_SHARD_COUNT; i++) {
+    event_shards[i] = create_list();
+    if (event_shards[i] == NULL) {
+      while (i-- > 0) {
+        free_list(event_shards[i]);
+      }
+      return 1;
+    }
   }
 
-  free_list(event_list);
-  pthread_rwlock_unlock(&event_list->rwl);
+  state_access_delay_us = delay_us;
+  initialized = 1;
+
   return 0;
 }
 
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
-  if (event_list == NULL) {
+int ems_terminate() {
+  if (!initialized) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_wrlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
-    return 1;
+  for (size_t i = 0; i < EVENT_SHARD_COUNT; i++) {
+    if (pthread_rwlock_wrlock(&event_shards[i]->rwl) != 0) {
+      fprintf(stderr, "Error locking list rwl\n");
+      return 1;
+    }
+
+    pthread_rwlock_unlock(&event_shards[i]->rwl);
+    free_list(event_shards[i]);
+    event_shards[i] = NULL;
   }
 
-  if (get_event_with_delay(event_id, event_list->head, event_list->tail) != NULL) {
+  epoch_terminate();
+
+  initialized = 0;
+  return 0;
+}
+
+/// Creates a new event in its shard.
+/// @note The shard must be write-locked.
+/// @param shard Shard of the event.
+/// @param event_id Id of the event to be created.
+/// @param num_rows Number of rows of the event to be created.
+/// @param num_cols Number of columns of the event to be created.
+/// @return 0 if the event was created successfully, 1 otherwise.
+static int create_in_shard(struct EventList* shard, unsigned int event_id, size_t num_rows, size_t num_cols) {
+  if (get_event_with_delay(event_id) != NULL) {
     fprintf(stderr, "Event already exists\n");
-    pthread_rwlock_unlock(&event_list->rwl);
     return 1;
   }
 
-  struct Event* event = malloc(sizeof(struct Event));
+  struct Event* event = create_event(event_id, num_rows, num_cols);
 
   if (event == NULL) {
     fprintf(stderr, "Error allocating memory for event\n");
-    pthread_rwlock_unlock(&event_list->rwl);
     return 1;
   }
 
-  event->id = event_id;
-  event->rows = num_rows;
-  event->cols = num_cols;
-  event->reservations = 0;
-  if (pthread_mutex_init(&event->mutex, NULL) != 0) {
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event);
-    return 1;
-  }
-  event->data = calloc(num_rows * num_cols, sizeof(unsigned int));
-
-  if (event->data == NULL) {
-    fprintf(stderr, "Error allocating memory for event data\n");
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event);
-    return 1;
-  }
+  event->seq = atomic_fetch_add(&next_event_seq, 1);
 
-  if (append_to_list(event_list, event) != 0) {
+  if (append_to_list(shard, event) != 0) {
     fprintf(stderr, "Error appending event to list\n");
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event->data);
-    free(event);
+    free_event(event);
     return 1;
   }
 
-  pthread_rwlock_unlock(&event_list->rwl);
   return 0;
 }
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
-  if (event_list == NULL) {
+int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
+  if (!initialized) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
+  struct EventList* shard = shard_of(event_id);
+
+  if (pthread_rwlock_wrlock(&shard->rwl) != 0) {
     fprintf(stderr, "Error locking list rwl\n");
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id, event_list->head, event_list->tail);
-
-  pthread_rwlock_unlock(&event_list->rwl);
+  int result = create_in_shard(shard, event_id, num_rows, num_cols);
 
-  if (event == NULL) {
-    fprintf(stderr, "Event not found\n");
-    return 1;
-  }
-
-  if (pthread_mutex_lock(&event->mutex) != 0) {
-    fprintf(stderr, "Error locking mutex\n");
-    return 1;
-  }
+  pthread_rwlock_unlock(&shard->rwl);
+  return result;
+}
 
+/// Creates a new reservation for an event.
+/// @note The event must be kept from being freed, by the epoch or by its locked shard.
+/// @param event Event to create a reservation for.
+/// @param num_seats Number of seats to reserve.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+static int reserve_in_event(struct Event* event, size_t num_seats, size_t* xs, size_t* ys) {
   for (size_t i = 0; i < num_seats; i++) {
     if (xs[i] <= 0 || xs[i] > event->rows || ys[i] <= 0 || ys[i] > event->cols) {
       fprintf(stderr, "Seat out of bounds\n");
-      pthread_mutex_unlock(&event->mutex);
       return 1;
     }
   }
 
-  for (size_t i = 0; i < event->rows * event->cols; i++) {
-    for (size_t j = 0; j < num_seats; j++) {
-      if (seat_index(event, xs[j], ys[j]) != i) {
-        continue;
-      }
+  size_t tiles[num_seats + 1];
+  size_t num_tiles = seat_tiles(event, num_seats, xs, ys, tiles);
+  unsigned int reservation_id = 0;
 
-      if (event->data[i] != 0) {
-        fprintf(stderr, "Seat already reserved\n");
-        pthread_mutex_unlock(&event->mutex);
-        return 1;
-      }
+  // Small reservations claim their seats without any mutex, and only fall back to locking their tiles when a tile
+  // must be allocated or widened (or is locked by a reservation doing so)
+  if (num_seats <= MAX_OPTIMISTIC_SEATS && enter_tiles(event, num_tiles, tiles) == 0) {
+    if (claim_seats(event, num_seats, xs, ys) != 0) {
+      fprintf(stderr, "Seat already reserved\n");
+      leave_tiles(event, num_tiles, tiles, 0);
+      return 1;
+    }
 
-      break;
+    reservation_id = atomic_fetch_add(&event->reservations, 1) + 1;
+    if (write_seats(event, num_seats, xs, ys, reservation_id) == 0) {
+      leave_tiles(event, num_tiles, tiles, 1);
+      return 0;
     }
+
+    leave_tiles(event, num_tiles, tiles, 0);
   }
 
-  unsigned int reservation_id = ++event->reservations;
+  // Only the tiles with requested seats are locked, reservations on other tiles of the event run in parallel
+  lock_tiles(event, num_tiles, tiles);
 
-  for (size_t i = 0; i < num_seats; i++) {
-    event->data[seat_index(event, xs[i], ys[i])] = reservation_id;
+  if (reservation_id == 0) {
+    if (claim_seats(event, num_seats, xs, ys) != 0) {
+      fprintf(stderr, "Seat already reserved\n");
+      unlock_tiles(event, num_tiles, tiles);
+      return 1;
+    }
+
+    reservation_id = atomic_fetch_add(&event->reservations, 1) + 1;
+  }
+
+  // Allocate or widen every tile first, so that a failure leaves no seat reserved
+  for (size_t i = 0; i < num_tiles; i++) {
+    if (writable_tile(event, tiles[i], reservation_id) == NULL) {
+      fprintf(stderr, "Error allocating memory for event data\n");
+      release_seats(event, num_seats, xs, ys);
+      unlock_tiles(event, num_tiles, tiles);
+      return 1;
+    }
   }
 
-  pthread_mutex_unlock(&event->mutex);
+  write_seats(event, num_seats, xs, ys, reservation_id);
+
+  unlock_tiles(event, num_tiles, tiles);
   return 0;
 }
 
-int ems_show(int out_fd, unsigned int event_id) {
-  if (event_list == NULL) {
+int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  if (!initialized) {
     fprintf(stderr, "EMS state must be initialized\n");
-    error_msg(out_fd);
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
+  struct EventList* shard = shard_of(event_id);
+
+  // The event may be deleted once the shard is unlocked, the epoch keeps it from being freed
+  if (epoch_enter() != 0) {
+    fprintf(stderr, "Error entering epoch\n");
+    return 1;
+  }
+
+  if (pthread_rwlock_rdlock(&shard->rwl) != 0) {
     fprintf(stderr, "Error locking list rwl\n");
-    error_msg(out_fd);
+    epoch_exit();
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id, event_list->head, event_list->tail);
+  struct Event* event = get_event_with_delay(event_id);
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  pthread_rwlock_unlock(&shard->rwl);
 
   if (event == NULL) {
     fprintf(stderr, "Event not found\n");
-    error_msg(out_fd);
+    epoch_exit();
     return 1;
   }
 
-  if (pthread_mutex_lock(&event->mutex) != 0) {
-    fprintf(stderr, "Error locking mutex\n");
-    error_msg(out_fd);
+  int result = reserve_in_event(event, num_seats, xs, ys);
+
+  epoch_exit();
+  return result;
+}
+
+int ems_show(int out_fd, const struct FrameHeader* request, unsigned int event_id) {
+  if (!initialized) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    send_status(out_fd, request, 1);
     return 1;
   }
 
-  unsigned int seats[event->rows * event->cols];
-  for (size_t i = 1; i <= event->rows; i++) {
-    for (size_t j = 1; j <= event->cols; j++) {
-      seats[seat_index(event, i, j)] = event->data[seat_index(event, i, j)];
-    }
+  struct EventList* shard = shard_of(event_id);
+
+  if (epoch_enter() != 0) {
+    fprintf(stderr, "Error entering epoch\n");
+    send_status(out_fd, request, 1);
+    return 1;
   }
 
-  int response = 0;
-  if (write(out_fd, &response, sizeof(int)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    pthread_mutex_unlock(&event->mutex);
+  if (pthread_rwlock_rdlock(&shard->rwl) != 0) {
+    fprintf(stderr, "Error locking list rwl\n");
+    send_status(out_fd, request, 1);
+    epoch_exit();
     return 1;
   }
 
-  if (write(out_fd, &event->rows, sizeof(size_t)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    pthread_mutex_unlock(&event->mutex);
+  struct Event* event = get_event_with_delay(event_id);
+
+  pthread_rwlock_unlock(&shard->rwl);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    send_status(out_fd, request, 1);
+    epoch_exit();
     return 1;
   }
 
-  if (write(out_fd, &event->cols, sizeof(size_t)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    pthread_mutex_unlock(&event->mutex);
+  size_t num_rows = event->rows, num_cols = event->cols, size;
+  unsigned char* seats = snapshot_seats(event, &size);
+  epoch_exit();
+
+  if (seats == NULL) {
+    fprintf(stderr, "Error allocating memory for seats\n");
+    send_status(out_fd, request, 1);
     return 1;
   }
 
-  if (write(out_fd, seats, sizeof(unsigned int) * event->rows * event->cols) == -1) {
+  // Width of each tile followed by the tiles with reservations, empty tiles are not sent
+  int response = 0;
+  struct iovec payload[] = {{.iov_base = &response, .iov_len = sizeof(int)},
+                            {.iov_base = &num_rows, .iov_len = sizeof(size_t)},
+                            {.iov_base = &num_cols, .iov_len = sizeof(size_t)},
+                            {.iov_base = seats, .iov_len = size}};
+  if (send_frame(out_fd, request->op, request->request_id, request->session_id, payload, 4)) {
     fprintf(stderr, "Error writing to pipe\n");
-    pthread_mutex_unlock(&event->mutex);
+    free(seats);
     return 1;
   }
 
-  pthread_mutex_unlock(&event->mutex);
+  free(seats);
   return 0;
 }
 
-int ems_list_events(int out_fd) {
-  if (event_list == NULL) {
+/// Frees a deleted event once no reader can be holding it.
+static void free_deleted_event(void* event) { free_event((struct Event*)event); }
+
+int ems_delete(unsigned int event_id) {
+  if (!initialized) {
     fprintf(stderr, "EMS state must be initialized\n");
-    error_msg(out_fd);
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
+  struct EventList* shard = shard_of(event_id);
+
+  if (pthread_rwlock_wrlock(&shard->rwl) != 0) {
     fprintf(stderr, "Error locking list rwl\n");
-    error_msg(out_fd);
     return 1;
   }
 
-  struct ListNode* current = event_list->head;
+  if (get_event_with_delay(event_id) == NULL) {
+    fprintf(stderr, "Event not found\n");
+    pthread_rwlock_unlock(&shard->rwl);
+    return 1;
+  }
 
-  int response = 0;
-  size_t num_events = get_num_events(current);
-  unsigned int event_ids[num_events];
+  struct Event* event = remove_from_list(shard, event_id);
 
-  for (size_t i = 0; i < num_events; i++) {
-    event_ids[i] = (current->event)->id;
-    current = current->next;
+  pthread_rwlock_unlock(&shard->rwl);
+
+  // Readers of ems_reserve and ems_show may still be using the event after unlocking the shard
+  if (epoch_retire(event, free_deleted_event) != 0) {
+    fprintf(stderr, "Error retiring event, it will not be freed\n");
   }
 
-  if (write(out_fd, &response, sizeof(int)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    pthread_rwlock_unlock(&event_list->rwl);
+  return 0;
+}
+
+int ems_list_events(int out_fd, const struct FrameHeader* request) {
+  if (!initialized) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    send_status(out_fd, request, 1);
     return 1;
   }
 
-  if (write(out_fd, &num_events, sizeof(size_t)) == -1) {
-    fprintf(stderr, "Error writing to pipe\n");
-    pthread_rwlock_unlock(&event_list->rwl);
+  if (lock_all_shards() != 0) {
+    fprintf(stderr, "Error locking list rwl\n");
+    send_status(out_fd, request, 1);
+    return 1;
+  }
+
+  size_t num_events;
+  unsigned int* event_ids = collect_event_ids(&num_events);
+  unlock_all_shards();
+
+  if (event_ids == NULL) {
+    fprintf(stderr, "Error allocating memory for event ids\n");
+    send_status(out_fd, request, 1);
     return 1;
   }
 
-  if (write(out_fd, event_ids, sizeof(unsigned int) * num_events) == -1) {
+  int response = 0;
+  struct iovec payload[] = {{.iov_base = &response, .iov_len = sizeof(int)},
+                            {.iov_base = &num_events, .iov_len = sizeof(size_t)},
+                            {.iov_base = event_ids, .iov_len = sizeof(unsigned int) * num_events}};
+  if (send_frame(out_fd, request->op, request->request_id, request->session_id, payload, 3)) {
     fprintf(stderr, "Error writing to pipe\n");
-    pthread_rwlock_unlock(&event_list->rwl);
+    free(event_ids);
     return 1;
   }
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  free(event_ids);
   return 0;
 }
 
-int ems_print_all(int out_fd) {
-  if (event_list == NULL) {
+// Response of a BATCH, grown as the results of its commands are added
+struct BatchResponse {
+  unsigned char* data;
+  size_t size, capacity;
+};
+
+/// Adds a field to the response of a BATCH.
+/// @param response The response.
+/// @param field The field to add.
+/// @param size Size of the field.
+/// @return 0 if the field was added successfully, 1 otherwise.
+static int batch_add(struct BatchResponse* response, const void* field, size_t size) {
+  if (response->size + size > response->capacity) {
+    size_t capacity = response->capacity * 2 > response->size + size ? response->capacity * 2 : response->size + size;
+    unsigned char* data = realloc(response->data, capacity);
+    if (data == NULL) return 1;
+
+    response->data = data;
+    response->capacity = capacity;
+  }
+
+  memcpy(response->data + response->size, field, size);
+  response->size += size;
+  return 0;
+}
+
+/// Runs a command of a BATCH and adds its result to the response.
+/// @note The thread must be in an epoch, and the shards used by the command must be read-locked so that its events can
+/// not be deleted while it runs. A CREATE write-locks its shard itself, no shard may be locked for it.
+/// @param command The command to run.
+/// @param response The response of the batch.
+/// @return 0 if the result was added to the response, 1 otherwise.
+static int run_batch_command(const struct BatchCommand* command, struct BatchResponse* response) {
+  struct Event* event;
+  int status = 1;
+
+  if (batch_add(response, &command->op, sizeof(uint8_t))) return 1;
+
+  switch (command->op) {
+    case OP_CREATE:
+      status = ems_create(command->event_id, command->num_rows, command->num_cols);
+      break;
+
+    case OP_RESERVE:
+      event = get_event_with_delay(command->event_id);
+      if (event == NULL) {
+        fprintf(stderr, "Event not found\n");
+        break;
+      }
+
+      status = reserve_in_event(event, command->num_seats, command->xs, command->ys);
+      break;
+
+    case OP_SHOW: {
+      event = get_event_with_delay(command->event_id);
+      if (event == NULL) {
+        fprintf(stderr, "Event not found\n");
+        break;
+      }
+
+      size_t size;
+      unsigned char* seats = snapshot_seats(event, &size);
+      if (seats == NULL) {
+        fprintf(stderr, "Error allocating memory for seats\n");
+        break;
+      }
+
+      status = 0;
+      int failed = batch_add(response, &status, sizeof(int)) || batch_add(response, &event->rows, sizeof(size_t)) ||
+                   batch_add(response, &event->cols, sizeof(size_t)) || batch_add(response, seats, size);
+      free(seats);
+      return failed;
+    }
+
+    case OP_LIST_EVENTS: {
+      size_t num_events;
+      unsigned int* event_ids = collect_event_ids(&num_events);
+      if (event_ids == NULL) {
+        fprintf(stderr, "Error allocating memory for event ids\n");
+        break;
+      }
+
+      status = 0;
+      int failed = batch_add(response, &status, sizeof(int)) || batch_add(response, &num_events, sizeof(size_t)) ||
+                   batch_add(response, event_ids, num_events * sizeof(unsigned int));
+      free(event_ids);
+      return failed;
+    }
+
+    default:
+      break;
+  }
+
+  return batch_add(response, &status, sizeof(int));
+}
+
+/// Unlocks the shards locked for a BATCH.
+/// @param used Whether each shard is locked.
+/// @param count Number of shards to unlock, from the first.
+static void unlock_batch_shards(const unsigned char used[EVENT_SHARD_COUNT], size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (used[i]) pthread_rwlock_unlock(&event_shards[i]->rwl);
+  }
+}
+
+/// Read-locks the shards used by a BATCH, in order like lock_all_shards, so batches can not deadlock.
+/// @param used Whether each shard is used.
+/// @return 0 if the shards were locked, 1 otherwise (no shard is left locked).
+static int lock_batch_shards(const unsigned char used[EVENT_SHARD_COUNT]) {
+  for (size_t i = 0; i < EVENT_SHARD_COUNT; i++) {
+    if (used[i] && pthread_rwlock_rdlock(&event_shards[i]->rwl) != 0) {
+      unlock_batch_shards(used, i);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int ems_batch(int out_fd, const struct FrameHeader* request, const struct BatchCommand* commands, size_t num_commands) {
+  if (!initialized) {
     fprintf(stderr, "EMS state must be initialized\n");
+    send_status(out_fd, request, 1);
+    return 1;
+  }
+
+  // Each shard read by the batch is read-locked once for all its commands, so other sessions keep reading it. A CREATE
+  // write-locks its shard alone, with the others unlocked, so that it neither blocks the shard for the whole batch nor
+  // waits for a write lock while holding read locks.
+  unsigned char used[EVENT_SHARD_COUNT] = {0};
+  for (size_t i = 0; i < num_commands; i++) {
+    if (commands[i].op == OP_LIST_EVENTS) {
+      memset(used, 1, sizeof(used));
+    } else if (commands[i].op != OP_CREATE) {
+      used[commands[i].event_id % EVENT_SHARD_COUNT] = 1;
+    }
+  }
+
+  // Tiles read by SHOW may be widened and retired by reservations of other sessions, the epoch keeps them from being
+  // freed
+  if (epoch_enter() != 0) {
+    fprintf(stderr, "Error entering epoch\n");
+    send_status(out_fd, request, 1);
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
+  if (lock_batch_shards(used) != 0) {
     fprintf(stderr, "Error locking list rwl\n");
+    epoch_exit();
+    send_status(out_fd, request, 1);
     return 1;
   }
 
-  struct ListNode* to = event_list->tail;
-  struct ListNode* current = event_list->head;
+  struct BatchResponse response = {0};
+  int status = 0, locked = 1;
+  int failed = batch_add(&response, &status, sizeof(int)) || batch_add(&response, &num_commands, sizeof(size_t));
+  for (size_t i = 0; i < num_commands && !failed; i++) {
+    if (commands[i].op != OP_CREATE) {
+      failed = run_batch_command(&commands[i], &response);
+      continue;
+    }
 
-  if (current == NULL) {
-    char buff[] = "No events\n";
-    if (print_str(out_fd, buff)) {
-      perror("Error writing to file descriptor");
-      pthread_rwlock_unlock(&event_list->rwl);
-      return 1;
+    unlock_batch_shards(used, EVENT_SHARD_COUNT);
+    failed = run_batch_command(&commands[i], &response);
+    if (lock_batch_shards(used) != 0) {
+      fprintf(stderr, "Error locking list rwl\n");
+      locked = 0;
+      failed = 1;
     }
+  }
 
-    pthread_rwlock_unlock(&event_list->rwl);
-    return 0;
+  if (locked) unlock_batch_shards(used, EVENT_SHARD_COUNT);
+  epoch_exit();
+
+  // The commands run so far are not undone
+  if (failed) {
+    fprintf(stderr, "Error running batch\n");
+    free(response.data);
+    send_status(out_fd, request, 1);
+    return 1;
   }
 
-  while (1) {
-    char buff[] = "Event: ";
-    if (print_str(out_fd, buff)) {
-      perror("Error writing to file descriptor");
-      pthread_rwlock_unlock(&event_list->rwl);
-      return 1;
-    }
+  struct iovec payload = {.iov_base = response.data, .iov_len = response.size};
+  if (send_frame(out_fd, request->op, request->request_id, request->session_id, &payload, 1)) {
+    fprintf(stderr, "Error writing to pipe\n");
+    free(response.data);
+    return 1;
+  }
 
-    char id[16];
-    sprintf(id, "%u\n", (current->event)->id);
-    if (print_str(out_fd, id)) {
-      perror("Error writing to file descriptor");
-      pthread_rwlock_unlock(&event_list->rwl);
-      return 1;
-    }
+  free(response.data);
+  return 0;
+}
 
-    for (size_t i = 1; i <= (current->event)->rows; i++) {
-      for (size_t j = 1; j <= (current->event)->cols; j++) {
-        char buffer[16];
-        sprintf(buffer, "%u", (current->event)->data[seat_index((current->event), i, j)]);
+// Copy of an event printed by ems_print_all
+struct EventSnapshot {
+  unsigned int id;
+  size_t cols, num_seats;
+  unsigned char* seats;  // Copy of the seats, as returned by snapshot_seats
+};
+
+/// Copies every event, in the order they were created, so that they are printed without holding any lock.
+/// @note The shards are only locked to list the events: their seats are copied afterwards like ems_show does, so
+/// creating events and reserving seats are not stalled by the copy.
+/// @param count Pointer to store the number of events in.
+/// @return Copies of the events, NULL on failure.
+static struct EventSnapshot* snapshot_events(size_t* count) {
+  // Deleted events are only freed once every copy is done
+  if (epoch_enter() != 0) {
+    fprintf(stderr, "Error entering epoch\n");
+    return NULL;
+  }
+
+  if (lock_all_shards() != 0) {
+    fprintf(stderr, "Error locking list rwl\n");
+    epoch_exit();
+    return NULL;
+  }
 
-        if (print_str(out_fd, buffer)) {
-          perror("Error writing to file descriptor");
-          pthread_mutex_unlock(&(current->event)->mutex);
-          return 1;
-        }
+  struct ListNode* cursors[EVENT_SHARD_COUNT];
+  *count = 0;
+  for (size_t i = 0; i < EVENT_SHARD_COUNT; i++) {
+    cursors[i] = event_shards[i]->head;
+    *count += get_num_events(cursors[i]);
+  }
 
-        if (j < (current->event)->cols) {
-          if (print_str(out_fd, " ")) {
-            perror("Error writing to file descriptor");
-            pthread_mutex_unlock(&(current->event)->mutex);
-            return 1;
-          }
-        }
-      }
+  struct Event** listed = malloc(*count * sizeof(struct Event*) + 1);
+  struct EventSnapshot* events = malloc(*count * sizeof(struct EventSnapshot) + 1);
+  if (listed == NULL || events == NULL) {
+    fprintf(stderr, "Error allocating memory for events\n");
+    unlock_all_shards();
+    epoch_exit();
+    free(listed);
+    free(events);
+    return NULL;
+  }
 
-      if (print_str(out_fd, "\n")) {
-        perror("Error writing to file descriptor");
-        pthread_mutex_unlock(&(current->event)->mutex);
-        return 1;
+  for (size_t i = 0; i < *count; i++) {
+    listed[i] = next_in_order(cursors)->event;
+  }
+
+  unlock_all_shards();
+
+  for (size_t i = 0; i < *count; i++) {
+    size_t size;
+    events[i].id = listed[i]->id;
+    events[i].cols = listed[i]->cols;
+    events[i].num_seats = listed[i]->rows * listed[i]->cols;
+    events[i].seats = snapshot_seats(listed[i], &size);
+
+    if (events[i].seats == NULL) {
+      fprintf(stderr, "Error allocating memory for seats\n");
+      epoch_exit();
+      while (i-- > 0) {
+        free(events[i].seats);
       }
+      free(listed);
+      free(events);
+      return NULL;
     }
+  }
 
-    if (current == to) {
-      break;
+  epoch_exit();
+  free(listed);
+  return events;
+}
+
+int ems_print_all(int out_fd) {
+  if (!initialized) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  size_t num_events;
+  struct EventSnapshot* events = snapshot_events(&num_events);
+  if (events == NULL) return 1;
+
+  struct OutBuffer out;
+  out_init(&out, out_fd);
+
+  int result = num_events == 0 ? out_str(&out, "No events\n") : 0;
+
+  for (size_t e = 0; e < num_events && result == 0; e++) {
+    result = out_str(&out, "Event: ") || out_uint(&out, events[e].id) || out_str(&out, "\n");
+
+    unsigned char* seats = events[e].seats;
+    size_t tiles = (events[e].num_seats + SEAT_TILE_SIZE - 1) / SEAT_TILE_SIZE;
+    size_t offset = tiles;
+    for (size_t t = 0; t < tiles && result == 0; t++) {
+      size_t count = events[e].num_seats - t * SEAT_TILE_SIZE < SEAT_TILE_SIZE ? events[e].num_seats - t * SEAT_TILE_SIZE
+                                                                               : SEAT_TILE_SIZE;
+      result = out_seat_tile(&out, seats + offset, seats[t], t * SEAT_TILE_SIZE, count, events[e].cols);
+      offset += seats[t] * count;
     }
+  }
 
-    current = current->next;
+  for (size_t e = 0; e < num_events; e++) {
+    free(events[e].seats);
   }
+  free(events);
 
-  pthread_rwlock_unlock(&event_list->rwl);
-  return 0;
-}
\ No newline at end of file
+  if (result == 0) result = out_flush(&out);
+  if (result) perror("Error writing to file descriptor");
+  return result;
+}
@@ -3,7 +3,7 @@
 
 #include <stddef.h>
 
-void error_msg(int out_fd);
+#include "common/protocol.h"
 
 /// Initializes the EMS state.
 /// @param delay_us Delay in microseconds.
@@ -28,16 +28,43 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
 /// @return 0 if the reservation was created successfully, 1 otherwise.
 int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
 
-/// Prints the given event.
-/// @param out_fd File descriptor to print the event to.
-/// @param event_id Id of the event to print.
-/// @return 0 if the event was printed successfully, 1 otherwise.
-int ems_show(int out_fd, unsigned int event_id);
+/// Sends the given event as the response to a SHOW request.
+/// @param out_fd File descriptor to send the response to.
+/// @param request The header of the request being answered.
+/// @param event_id Id of the event to send.
+/// @return 0 if the event was sent successfully, 1 otherwise (an error status is sent instead).
+int ems_show(int out_fd, const struct FrameHeader* request, unsigned int event_id);
 
-/// Prints all the events.
-/// @param out_fd File descriptor to print the events to.
-/// @return 0 if the events were printed successfully, 1 otherwise.
-int ems_list_events(int out_fd);
+/// Deletes the event with the given id.
+/// @note The event is freed once no ongoing operation can still be using it.
+/// @param event_id Id of the event to be deleted.
+/// @return 0 if the event was deleted successfully, 1 otherwise.
+int ems_delete(unsigned int event_id);
+
+/// Sends the ids of all the events as the response to a LIST request.
+/// @param out_fd File descriptor to send the response to.
+/// @param request The header of the request being answered.
+/// @return 0 if the events were sent successfully, 1 otherwise (an error status is sent instead).
+int ems_list_events(int out_fd, const struct FrameHeader* request);
+
+// Command of a BATCH request
+struct BatchCommand {
+  uint8_t op;                 // OP_CREATE, OP_RESERVE, OP_SHOW or OP_LIST_EVENTS
+  unsigned int event_id;      // Event of CREATE, RESERVE and SHOW
+  size_t num_rows, num_cols;  // Of CREATE
+  size_t num_seats;           // Of RESERVE
+  size_t *xs, *ys;            // Seats of RESERVE
+};
+
+/// Runs the commands of a BATCH request, in order, and sends their results as its response.
+/// @note The shards of the events of the batch are read-locked once for all its commands, instead of once per command.
+/// Each CREATE write-locks its shard on its own.
+/// @param out_fd File descriptor to send the response to.
+/// @param request The header of the request being answered.
+/// @param commands The commands of the batch.
+/// @param num_commands Number of commands.
+/// @return 0 if the batch was run and its response sent, 1 otherwise (an error status is sent instead).
+int ems_batch(int out_fd, const struct FrameHeader* request, const struct BatchCommand* commands, size_t num_commands);
 
 /// Prints all events and their reservations.
 /// @param out_fd File descriptor to print the events and their reservations to.